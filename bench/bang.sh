@@ -0,0 +1,13 @@
+#!/bin/sh
+# Eight independent processes of the big bang (bang.b), each the loop of
+# cells.b. With -p, each gets a core of its own.
+#
+# usage: bang.sh brains [options ...]
+#    as in: bang.sh ./brains -p
+
+dir=`dirname "$0"`
+
+start=`date +%s%N`
+"$@" "$dir/bang.b" > /dev/null
+end=`date +%s%N`
+echo "bang: $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Cell ops on a private segment (cells.b), on shared memory (cellss.b), and
+# on a segment with a second, sleeping, thread (cellst.b). The same loop
+# does about 50 million '+' and '-' in each.
+#
+# usage: cells.sh brains [options ...]
+#    as in: cells.sh ./brains -n
+
+dir=`dirname "$0"`
+
+for prog in cells cellss cellst
+ do
+   start=`date +%s%N`
+   "$@" "$dir/$prog.b" > /dev/null
+   end=`date +%s%N`
+   echo "$prog: $(( (end - start) / 1000000 )) ms"
+ done
@@ -0,0 +1,25 @@
+#!/bin/sh
+# A big bang of 201 processes, in 10 megabytes of program. The first
+# prints a line and the rest only count, so this times how long the line
+# takes to come out, and then the whole run. With -i, the first process
+# starts as soon as its segment is compiled.
+#
+# usage: early.sh brains [options ...]
+#    as in: early.sh ./brains -i -B l
+
+prog=`mktemp`
+trap 'rm -f "$prog"' EXIT
+
+{
+   printf '++++++++++[>++++++++++<-]>+++.<++++++++++.@'
+   seg=`yes '+>-<[>+<-]' | head -n 5000 | tr -d '\n'`
+   yes "$seg@" | head -n 200 | tr -d '\n'
+} > "$prog"
+
+start=`date +%s%N`
+"$@" "$prog" | { head -n 1 > /dev/null; date +%s%N > "$prog.first"; cat > /dev/null; }
+end=`date +%s%N`
+first=`cat "$prog.first"`
+rm -f "$prog.first"
+echo "early, first line: $(( (first - start) / 1000000 )) ms"
+echo "early, all: $(( (end - start) / 1000000 )) ms"
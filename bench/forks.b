@@ -0,0 +1 @@
+++++++++[>>%(>-[>-[>-[>+>-<<-]<-]<-]<~<<^$|<<-)]>________.
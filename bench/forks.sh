@@ -0,0 +1,14 @@
+#!/bin/sh
+# Eight forked processes (forks.b), each running the loop of cells.b, and
+# a parent that waits for them all on a semaphore. With -f, each child is
+# a real process.
+#
+# usage: forks.sh brains [options ...]
+#    as in: forks.sh ./brains -f
+
+dir=`dirname "$0"`
+
+start=`date +%s%N`
+"$@" "$dir/forks.b" > /dev/null
+end=`date +%s%N`
+echo "forks: $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,32 @@
+#!/bin/sh
+# A filter (filter.b): copies its input to its output, a byte at a time,
+# to a zero byte. Its input is 16 megabytes of text, read from a file, from
+# a pipe, and from after a '!' in the program, so nearly all it does is ','
+# and '.'.
+#
+# usage: input.sh brains [options ...]
+#    as in: input.sh ./brains -n
+
+dir=`dirname "$0"`
+in=`mktemp`
+prog=`mktemp`
+trap 'rm -f "$in" "$prog"' EXIT
+
+yes "All work and no play makes Jack a dull boy." | head -c 16777216 > "$in"
+printf '\000' >> "$in"
+{ cat "$dir/filter.b"; printf '!'; cat "$in"; } > "$prog"
+
+start=`date +%s%N`
+"$@" "$dir/filter.b" < "$in" > /dev/null
+end=`date +%s%N`
+echo "input, file: $(( (end - start) / 1000000 )) ms"
+
+start=`date +%s%N`
+cat "$in" | "$@" "$dir/filter.b" > /dev/null
+end=`date +%s%N`
+echo "input, pipe: $(( (end - start) / 1000000 )) ms"
+
+start=`date +%s%N`
+"$@" "$prog" < /dev/null > /dev/null
+end=`date +%s%N`
+echo "input, after '!': $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,24 @@
+#!/bin/sh
+# 2000 procedures, of 5000 bytes each, in 10 megabytes of program, and one
+# more that prints a line: the only one that is ever called. With -d, the
+# bodies are only checked up front, and just the one that runs is ever
+# compiled.
+#
+# usage: lazy.sh brains [options ...]
+#    as in: lazy.sh ./brains -d
+
+prog=`mktemp`
+trap 'rm -f "$prog"' EXIT
+
+{
+   body=`yes '+>-<[>+<-]' | head -n 500 | tr -d '\n'`
+   for name in a b c d e f g h i j k l m n o p q r s t; do
+      yes ":$name$body;" | head -n 100 | tr -d '\n'
+   done
+   printf ':P++++++++[>++++++++<-]>+.[-]<++++++++++.[-];P'
+} > "$prog"
+
+start=`date +%s%N`
+"$@" "$prog" > /dev/null
+end=`date +%s%N`
+echo "lazy: $(( (end - start) / 1000000 )) ms"
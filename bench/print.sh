@@ -0,0 +1,13 @@
+#!/bin/sh
+# Eight processes of the big bang (print.b), each printing its own letter
+# 65025 times, one '.' at a time. Nearly all they do is print.
+#
+# usage: print.sh brains [options ...]
+#    as in: print.sh ./brains -n -a
+
+dir=`dirname "$0"`
+
+start=`date +%s%N`
+"$@" "$dir/print.b" > /dev/null
+end=`date +%s%N`
+echo "print: $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,17 @@
+#!/bin/sh
+# Ranges: clears.b fills 1000 cells and clears them with [-]>, and
+# shifts.b moves a block of 1000 cells one to the right with [->+<]<,
+# each 65025 times over.
+#
+# usage: ranges.sh brains [options ...]
+#    as in: ranges.sh ./brains -q 0
+
+dir=`dirname "$0"`
+
+for prog in clears shifts
+do
+   start=`date +%s%N`
+   "$@" "$dir/$prog.b" > /dev/null
+   end=`date +%s%N`
+   echo "$prog: $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Semaphore contention: 2 to 64 threads on one semaphore (sem1.b), and on
+# each of eight semaphores (sem8.b). The input is the threads for each
+# semaphore, then the work for each, in tens of thousands of '_' '^' pairs.
+#
+# usage: sem.sh brains [options ...]
+#    as in: sem.sh ./brains -n
+
+dir=`dirname "$0"`
+
+for threads in 2 4 8 16 32 64
+ do
+   for prog in sem1 sem8
+    do
+      if [ $prog = sem1 ]; then work=200; else work=25; fi
+      start=`date +%s%N`
+      printf "\\$(printf %o $threads)\\$(printf %o $work)" |
+         "$@" -w 32 "$dir/$prog.b" > /dev/null
+      end=`date +%s%N`
+      echo "$prog $threads threads: $(( (end - start) / 1000000 )) ms"
+    done
+ done
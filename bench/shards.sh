@@ -0,0 +1,21 @@
+#!/bin/sh
+# The big bang (bang.b) dealt out to shards, and two processes that play
+# ping-pong on two semaphores of the system memory (pingpong.b), each time
+# with 1, 2, 4 and 8 shards, and once green to compare.
+#
+# usage: shards.sh brains [options ...]
+#    as in: shards.sh ./brains -w 32
+
+dir=`dirname "$0"`
+
+for s in green 1 2 4 8
+ do
+   if [ $s = green ]; then opt=""; else opt="-s $s"; fi
+   for b in bang pingpong
+    do
+      start=`date +%s%N`
+      "$@" $opt "$dir/$b.b" > /dev/null
+      end=`date +%s%N`
+      echo "$b $s: $(( (end - start) / 1000000 )) ms"
+    done
+ done
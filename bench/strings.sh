@@ -0,0 +1,24 @@
+#!/bin/sh
+# Strings (strings.b): reads 60000 bytes of text into the tape with [>,],
+# then prints it 255 times over with [.>], so nearly all it does is those
+# two loops, in the green loop and with forks.
+#
+# usage: strings.sh brains [options ...]
+#    as in: strings.sh ./brains -q 0
+
+dir=`dirname "$0"`
+in=`mktemp`
+trap 'rm -f "$in"' EXIT
+
+yes "All work and no play makes Jack a dull boy." | head -c 60000 > "$in"
+printf '\000' >> "$in"
+
+start=`date +%s%N`
+"$@" "$dir/strings.b" < "$in" > /dev/null
+end=`date +%s%N`
+echo "strings: $(( (end - start) / 1000000 )) ms"
+
+start=`date +%s%N`
+"$@" -f "$dir/strings.b" < "$in" > /dev/null
+end=`date +%s%N`
+echo "strings, -f: $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Bursts (burst.b): four rounds, each of which computes for a while, then
+# prints 255k, far more than a pipe holds. It is timed printing to nowhere,
+# and to a late reader, that only starts reading after half a second.
+#
+# usage: writer.sh brains [options ...]
+#    as in: writer.sh ./brains -W
+
+dir=`dirname "$0"`
+
+start=`date +%s%N`
+"$@" "$dir/burst.b" > /dev/null
+end=`date +%s%N`
+echo "writer, to nowhere: $(( (end - start) / 1000000 )) ms"
+
+start=`date +%s%N`
+"$@" "$dir/burst.b" | { sleep 0.5; cat > /dev/null; }
+end=`date +%s%N`
+echo "writer, to a late reader: $(( (end - start) / 1000000 )) ms"
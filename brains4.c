@@ -52,6 +52,12 @@
 
    Some implementation fluff:
       All base process share a system block of memory.
+      The tape is 65536 eight-bit cells, unless the -t (any power of two)
+         and -w (8, 16 or 32) options say otherwise. The data pointer wraps
+         around the ends of the tape. A fork copies all of the tape. With
+         -r, each tape is a ring: the same memory mapped twice in a row.
+      Instructions are an int each. Runs and jumps too long for the
+         instruction are laid out after it, in a long.
       An attempted call to an undefined function costs zero clock ticks.
          Until defined, function names are considered comments.
       A failed definition of a function costs one tick.
@@ -89,10 +95,123 @@
       In addition: define INFANTICIDE to get proper process death semantics.
          In this implementation, when all of the threads of a process
          terminate, the process is terminated, but its children live on.
+         Its data segment is reference counted, and lives on until the last
+         of those children dies, as they can still '~' into it.
          With INFANTICIDE defined as a compile option, when all of the threads
          of a process terminate, the process is terminated, and all of its
          children are murdered, like UNIX or Windows would do.
 
+      With -n, brains threads are native: each is an OS thread of its own,
+         and all of them run at once, on as many cores as there are. They
+         share their segments as they are, so '^' and '_' are atomic, and
+         one '.' or ',' is never cut in two by another thread's. Quanta
+         mean nothing here, and '*' yields the core. Where other threads
+         can get at a segment, every cell op on it is atomic: '+', '-' and
+         '"' are relaxed, so they are never lost, but say nothing about
+         other cells. '^' is a release and '_' an acquire, so what was
+         written before a '^' is seen after the '_' that takes it. A
+         process's own segment, with one thread and no live children, is
+         private: its ops are plain. A thread that can't '_' spins on the
+         cell for a little while, then sleeps on a futex, until a '^' on
+         that very cell. When every thread is asleep, they all die. Build
+         with -pthread, on Linux.
+      With -m, brains threads are green again, but they are run by a
+         worker thread on each core (or as many as asked for: 0 is a core
+         each), which steal threads from each other when they run out.
+         Each thread runs a quanta at a time, as it would on one core.
+      With -p, each process of the big bang gets an OS thread of its own,
+         and it and all of its descendants are green threads on it, run
+         by the usual scheduler. The families only meet in the system
+         memory, so only its cells are atomic, and only a '_' on one of
+         them sleeps where another family's '^' can wake it.
+      With -f, a '%' forks the interpreter itself, and the new process runs
+         in the child, green, with its own descendants. Segments are shared
+         mappings, so the child still reaches its parent's with '~', and
+         everyone the system memory. A '^' on a segment that another
+         process can reach wakes every process that waits, to look again.
+         Input is read unbuffered, so that processes never read the same
+         byte twice; output is flushed before each fork.
+      With -s, the processes of the big bang are dealt out to shards: as
+         many worker processes as asked for (0 for one a core), each of
+         which runs its share, and their descendants, green. They talk to
+         the interpreter, which keeps the system memory, over Unix sockets.
+         Each shard has a copy of the system memory of its own. What it
+         changes goes back at each '^' and '_', and what the others changed
+         comes in with each '_' granted, so that a '_' sees all that was
+         done before the '^' that it takes. Nothing else is promised: a
+         loop that waits on a cell of the system memory, without a '_',
+         can wait for good. Not for ring tapes.
+      A loop that only moves and does arithmetic is marked private by the
+         compiler: it can't leave its segment, or share it, or be seen by
+         anyone else before it ends. On a private segment, such a loop
+         runs without atomics, and where quanta mean nothing (-n, or a
+         quanta of zero), without counting ticks either. With -u, private
+         loops always run to the end, as one tick: a thread in one isn't
+         stopped for others, which can starve them if it never ends.
+      The compiler also knows two loops for strings: [.>], which prints
+         cells up to a zero, and [>,], which reads into cells up to a zero
+         byte. Each runs as many turns at once as its ticks pay for: the
+         print finds the zero with memchr() and prints up to it in one go,
+         and the read copies what input is there into the cells. Ticks
+         are counted as the loop would, so slices end where they did. Not
+         where each '.' takes a ticket, or where input is logged, or for
+         native reads.
+      Loops that only shuffle cells are compiled to one op, and one tick,
+         as [-] always was: [->+<] (and the like, to any cell so far off,
+         either way) adds the cell into the other and clears it. A run of
+         [-]> clears that many cells, with a memset(). A run of [->+<]<,
+         which moves a block of cells one to the right, is a memmove(),
+         as is a run of [-<+>]>, which moves one to the left.
+      With -n, -m or -p, each thread buffers its output, and every '.'
+         is stamped, so that when the buffers are written out, it is in
+         the order that the '.'s were done in. With -a, each buffer is
+         written out by itself, and only each thread's own order is kept.
+      Green threads' output is buffered by the interpreter, in -b bytes
+         (64k), and written out when full, at the end, and as -B says: at
+         a newline (l), before a ',' (i), or neither (f). The default is
+         li on a terminal, and f otherwise.
+      With -W, output is written out by a thread of its own, from a ring
+         of a megabyte, so that a slow reader only holds up the run once
+         the ring is full. Not with -f or -s.
+      With -o name, the nth process of the big bang, counting from 0, and
+         all of its descendants print to the file name.n, rather than to
+         stdout. With -o &fd, they print to fd + n, as in 3>a 4>b. Each
+         has its own buffer, of -b bytes, written out when it is full and
+         at the end, whatever -B says.
+      With -l, a green run writes a log of its random slices and of its
+         input, and with -L it is replayed from one, slice for slice, and
+         without reading any input. The quanta, the scheduler, -u and the
+         tape come from the log; the files must be the same.
+      Input is read through a buffer of the interpreter's own; a regular
+         file is mapped instead. A run of ','s takes as many bytes as it
+         is long, and keeps the last. The program file is read the same
+         way, and the input after its '!' comes right from the mapping
+         the compiler read. Forks and shards share a mapped input through
+         an offset in shared memory; other input they read just as they
+         take it, as they share the file. A ',' waits for its input.
+      With -A, a green thread whose ',' finds no input waiting is put
+         aside until some comes, and the others run; with nothing else to
+         run, the interpreter sleeps in poll(). The schedule then depends
+         on when the input comes, so the same program and input can print
+         differently from a pipe than from a file. Only green threads, and
+         not with -l or -L.
+      With -i, the processes of the big bang start as their segments are
+         compiled, not once the whole file is: green ones get one more
+         segment between slices, and with -n the others are compiled
+         while the first ones run. For that, the input after the '!' is
+         found up front, with a memchr(), which needs the file mapped;
+         a piped program is compiled whole first, as without -i. A bad
+         segment is reported, and the ones before it run to the end.
+         Only green threads and -n.
+      With -d, code is compiled as it first runs: up front, the brackets
+         of the whole file are checked, and nothing else, so that a bad
+         program still does nothing. Each '@' segment, and each body of a
+         procedure with a name, is then a LAZY op, which costs no tick,
+         and compiles it the first time it is reached, so a body that is
+         never called is never compiled. Loops are compiled with the code
+         around them. Like -i, it needs the file mapped, and does without
+         otherwise; with it, -i has nothing left to do.
+
    Final thoughts:
       I wanted to implement capabilities for read/write at least, so that
       a thread could spawn another thread that wasn't allowed to print output,
@@ -112,6 +231,63 @@
  /*
    Change Log:
 
+      10/16/26
+         A green ',' waits for its input again, unless -A is given.
+         Dropped the compact (-c) encoding: it was no faster on anything,
+            for a second set of instruction loops.
+         Added -d: segments and procedure bodies are compiled the first
+            time they run, and only their brackets are checked up front.
+         Added -i: each process of the big bang starts as soon as its
+            segment is compiled. Schedule logs from before don't replay.
+         Runs of [-]> clear a range of cells at once, and move loops, and
+            runs of them that move a block of cells, are an op each.
+            Schedule logs from before don't replay the same.
+         The loops [.>] and [>,] print and read a string at a time.
+         Added -o: each process of the big bang, and its descendants,
+            prints to a file or fd of its own.
+         Added -W: output is written by a thread of its own, from a ring.
+         A green ',' with no input there yet waits in a list of its own,
+            as a '_' does, and the other threads run until it comes.
+         The program file is compiled from a mapping, not through stdio,
+            and the input after its '!' is read from the same mapping,
+            shared between forks. Running more than one file now works.
+         Input goes through a buffer of the interpreter's own, or a mapping
+            of a regular file, and a run of ','s takes its bytes at once.
+            Schedule logs record a read per ',' run.
+         Green output goes through a buffer of the interpreter's own, filled
+            a run at a time. Added -b and -B, for its size and when it is
+            written out.
+         Native threads, workers and families buffer their output, each
+            their own, and merge it by ticket. Added -a, not to merge it.
+         Added schedule logs: -l records a green run, and -L replays it.
+         Loops that keep to their own cells are marked private when
+            compiled, and run in a loop of their own. Added -u, to run
+            them unbroken under any quanta.
+         Added shards (-s): worker processes run the big bang between them,
+            and the interpreter serves the system memory over sockets.
+         Added forks (-f): '%' forks the interpreter, and segments are shared
+            mappings.
+         Added families (-p): each process of the big bang, with all of its
+            descendants, runs green on an OS thread of its own.
+         Native cell ops are atomic on shared segments, plain on private.
+         Native threads sleep on futexes, after an adaptive spin.
+         Added workers (-m): green threads run on a pool of OS threads.
+         Added native threads (-n): brains threads on OS threads.
+            A process's thread and reference counts are now atomic.
+         New threads now get all of the procedure list and call stack.
+         Instruction memory is sized from the program. The compiler works
+            in longs, and the rare operand too big for an instruction is
+            laid out after it.
+         Added ring tapes (-r), on which most moves don't wrap.
+         The tape size (-t) and cell width (-w) are options. Big tapes are
+            only reserved, and get committed as they are touched. Each kind
+            of tape gets its own instruction loop, built from quanta.h.
+         Dead processes' data segments are reference counted and freed when
+            no living child can reach them. INFANTICIDE no longer leaves
+            grandchildren with a dangling parent segment. A new process's
+            ready list is now initialized. Fixed a stale process pointer
+            in the process scheduler when running more than one file.
+
       10/3/11
          Fixed semantics of '`'. The loop [-] and [-`] should be equivalent.
 
@@ -148,21 +324,55 @@
 
       9/15/11 Version 0.1 beta release
  */
+#define _GNU_SOURCE
+
+#include <limits.h>
 #include <stdio.h>
+#include <stdio_ext.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+#include <sched.h>
+
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 
 
 #define DEFAULTQUANTA 10
 
 #define DMEM 65536
 #define DMASK (DMEM - 1)
-#define IMEM (1<<24)
+#define MAPMIN (1<<20) /* Segments this big are mmap'd, and lazily faulted */
+#define CMEM (1L<<33) /* Compiler scratch to reserve for unsized input */
 
 #define IMASK 255
 #define SHIFT 8
+#define MAXARG (INT_MAX >> SHIFT)
+
+#define WIDE 128 /* The operand didn't fit, and follows the instruction */
+#define ISIZE sizeof(int) /* Bytes in an instruction */
+#define WIDELEN (1 + sizeof(long) / ISIZE)
+
+#define RMOVE 1 /* Move right without wrapping: only on a ring tape */
+#define PLOOP 2 /* A '[' whose loop keeps to its own cells: see privateLoop */
+#define PRINTS 3 /* The '.' of [.>]: prints up to a zero, in one go */
+#define READS 4 /* The '>' of [>,]: reads into the cells, up to a zero */
+#define CLEARS 5 /* [-]> some times over: clears that many cells */
+#define MOVES 6 /* [->+<]: adds the cell to the one so far off, and clears it */
+#define SHIFTR 7 /* [->+<]< some times over: moves that many cells right */
+#define SHIFTL 8 /* [-<+>]> some times over: moves that many cells left */
+#define LAZY 9 /* With -d: code that is compiled the first time it runs */
 
 #define SCHEDULE_PROCESS 1
 #define SCHEDULE_THREAD 2
@@ -172,6 +382,53 @@
 
 #define STACKSIZE 1024
 
+#define OSTHREADS 1
+#define WORKERS 2
+#define FAMILIES 3
+#define FORKS 4
+#define SHARDS 5
+
+#define NBUCKET 1024 /* Sleeping native threads are hashed by cell */
+#define ASLEEP (1UL<<32)
+#define NSTACK (1<<17) /* Bytes of stack for a native thread */
+#define SPINMIN 16 /* Checks of a cell before a native '_' sleeps, */
+#define SPINMAX 4096 /* give or take what worked last time */
+
+ /* The word that forked processes share: live ones, asleep ones, wakes */
+#define FLIVE(w) ((w) & 0xffff)
+#define FASLEEP(w) (((w) >> 16) & 0xffff)
+#define FSLEEP (1UL<<16)
+#define FWAKE (1UL<<32)
+
+#define INSIZE 65536 /* Bytes of input read at once */
+#define NPUT 1024 /* '.'s that a thread's output buffer holds */
+#define OUTSIZE 65536 /* Bytes of the green threads' output buffer */
+#define WRITERSIZE (1 << 20) /* Bytes of the writer's ring, a power of 2 */
+#define FLINE 1 /* Write output out at a newline */
+#define FREAD 2 /* Write output out before a ',' */
+
+#define CHUNK 64 /* Cells of the system memory that a shard sends at once */
+
+ /* Messages between shards and the interpreter */
+#define SDIFF 1 /* What a shard changed in a chunk */
+#define SWAKE 2 /* A '^': look at who waits on the cell */
+#define SDOWN 3 /* A '_', to be granted */
+#define SIDLE 4 /* Nothing to do until a grant */
+#define SDONE 5 /* All of its threads are done */
+#define SCHUNK 6 /* A chunk, as it is now */
+#define SGRANT 7 /* A '_' done */
+#define SSTOP 8 /* Deadlocked */
+
+#define LOGMAGIC "brains log 4\n"
+#define LIN 0 /* In a log: a byte of input follows. A slice is 1 to 128 */
+#define LEOF 255 /* In a log: input ran out */
+
+#if defined(__i386__) || defined(__x86_64__)
+#define RELAX() __builtin_ia32_pause()
+#else
+#define RELAX()
+#endif
+
 #define GOOD 0
 #define BAD -2
 
@@ -184,10 +441,18 @@ struct PCB
 
    void * readyList; /* Ready Threads for this Process */
 
+   struct PCB * parent; /* Owner of pmem, NULL for the big bang */
+
    char * pmem; /* Parent's data Memory segment */
    char * dmem; /* My Data Memory segment */
 
    int threads;
+   int refs; /* References to dmem: me while I live, and my live children */
+
+   struct Family * home; /* Who runs me, with -p */
+   int forks; /* Children forked off, with -f: they can reach dmem */
+
+   struct Stream * out; /* What I print to, with -o */
  };
 
  /* Thread Control Block */
@@ -197,15 +462,20 @@ struct TCB
 
    struct PCB * par; /* Parent Process */
 
-   int * procs [NUMPROC]; /* Procedure List */
+   void * procs [NUMPROC]; /* Procedure List */
 
-   int * pc; /* Program Counter */
-   int dp; /* Data Pointer */
+   void * pc; /* Program Counter */
+   long dp; /* Data Pointer */
 
    char * cmem; /* Current Memory segment */
 
-   int * stack [STACKSIZE]; /* Call Stack */
+   void * stack [STACKSIZE]; /* Call Stack */
    int sp; /* Stack Pointer */
+
+   long want; /* What a native '_' is waiting for, or a green ',' has */
+   int asleep; /* An OS thread's futex */
+
+   struct Outbuf * out; /* What it printed, with -n, -m or -p */
  };
 
 
@@ -215,20 +485,34 @@ struct TCB
       The nice thing about a paging OS is that we don't have to pay for
       the memory until we use it.
  */
-struct PCB * pListHead = NULL;
-struct TCB * tListHead = NULL; /* Only used in per-thread scheduling */
-struct PCB * dpListHead = NULL; /* Only used in per-process scheduling */
-
-int  Gimem [IMEM]; /* Global Instruction Memory */
-char Gsmem [DMEM]; /* System Memory */
-
-struct TCB * sListHead = NULL;
+__thread struct PCB * pListHead = NULL;
+__thread struct TCB * tListHead = NULL; /* Only used in per-thread scheduling */
+__thread struct PCB * Gcurp = NULL; /* What the process scheduler is running */
+
+void * Gimem; /* Global Instruction Memory */
+char * Gsmem; /* System Memory */
+
+ /* The tape: Gcells cells of Gwidth bytes each, Gdbytes in all. */
+long Gcells = DMEM;
+long Gdmask = DMASK;
+int Gwidth = 1;
+size_t Gdbytes = DMEM;
+int Gring = 0; /* Segments are mapped twice in a row */
+int Gnative = 0; /* Threads run at once: as OSTHREADS, on WORKERS, in
+                    FAMILIES, FORKS or SHARDS */
+int Gunbound = 0; /* Private loops run to the end, in one tick */
+int Gearly = 0; /* -i: processes start as their segments compile */
+int Gdefer = 0; /* -d: segments and bodies compile as they first run */
+
+int (* doQuanta) (struct TCB * me, int quanta);
+int compileNext (void); /* With -i, the compiler runs between slices */
+void * lazyCode (long i); /* With -d, it runs as the code does */
+
+__thread struct TCB * sListHead = NULL;
+__thread struct TCB * rListHead = NULL; /* Green threads waiting on ',' */
 
 int scheduler = SCHEDULE_PROCESS;
 
- /* In Windows, stdin is not a REAL pointer. */
-FILE * useIn;
-
 
 
  /*
@@ -269,6 +553,99 @@ void freeTlist (struct TCB * head)
    return;
  }
 
+ /*
+   Allocates a ring segment: the same pages, mapped twice in a row, so that
+   running off of the end of the tape lands back at its start.
+ */
+char * allocRing (void)
+ {
+   char * mem;
+   int fd;
+
+   fd = memfd_create("brains", MFD_CLOEXEC);
+   if (fd < 0) return NULL;
+
+   mem = MAP_FAILED;
+   if (ftruncate(fd, Gdbytes) == 0)
+      mem = mmap(NULL, 2 * Gdbytes, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+   if ((mem != MAP_FAILED) &&
+       ((mmap(mem, Gdbytes, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+        (mmap(mem + Gdbytes, Gdbytes, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)))
+    {
+      munmap(mem, 2 * Gdbytes);
+      mem = MAP_FAILED;
+    }
+
+   close(fd);
+   return (mem == MAP_FAILED) ? NULL : mem;
+ }
+
+ /*
+   Allocates a data segment. Big ones are only reserved: the OS gives us
+   zeroed pages when they are first touched. With -f, they are all shared
+   mappings, which forks share rather than copy.
+ */
+char * allocSeg (int zero)
+ {
+   char * mem;
+
+   if (Gring) return allocRing();
+
+   if ((Gdbytes < MAPMIN) && (Gnative != FORKS))
+      return zero ? calloc(Gdbytes, 1) : malloc(Gdbytes);
+
+   mem = mmap(NULL, Gdbytes, PROT_READ | PROT_WRITE,
+              ((Gnative == FORKS) ? MAP_SHARED : MAP_PRIVATE) |
+              MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   return (mem == MAP_FAILED) ? NULL : mem;
+ }
+
+ /*
+   Frees a data segment.
+ */
+void freeSeg (char * mem)
+ {
+   if (Gring)
+      munmap(mem, 2 * Gdbytes);
+   else if ((Gdbytes < MAPMIN) && (Gnative != FORKS))
+      free(mem);
+   else
+      munmap(mem, Gdbytes);
+   return;
+ }
+
+ /*
+   Drops a reference to a process's data segment, freeing the process
+   with the last one.
+ */
+void releaseProcess (struct PCB * p)
+ {
+   if (__atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      freeSeg(p->dmem);
+      free(p);
+    }
+   return;
+ }
+
+ /*
+   Buries a process with no more threads. Its children may still '~' into
+   its data segment, but nothing can reach its parent's through it anymore.
+ */
+void buryProcess (struct PCB * p)
+ {
+   struct PCB * par;
+
+   par = p->parent;
+   releaseProcess(p);
+   if (par != NULL) releaseProcess(par);
+   return;
+ }
+
  /*
    Frees a PCB list.
  */
@@ -276,8 +653,8 @@ void freePlist (struct PCB * head)
  {
    if (head->next != NULL) freePlist(head->next);
    if (head->readyList != NULL) freeTlist(head->readyList);
-   free(head->dmem);
-   free(head);
+   head->next = NULL;
+   buryProcess(head);
    return;
  }
 
@@ -359,13 +736,13 @@ void recInfanticide (struct PCB * tpar)
          if (cur->readyList != NULL) freeTlist(cur->readyList);
          purge(&tListHead, cur);
          purge(&sListHead, cur);
+         purge(&rListHead, cur);
 
          if (last == NULL) pListHead = pListHead->next;
          else last->next = cur->next;
          cur->next = NULL;
 
-         free(cur->dmem);
-         free(cur);
+         buryProcess(cur);
 
          cur = last;
        }
@@ -404,11 +781,8 @@ void makeDead (struct PCB * me)
 
 #ifdef INFANTICIDE
       recInfanticide(cur);
-      free(cur->dmem);
-      free(cur);
-#else
-      appendList(&dpListHead, cur);
 #endif
+      buryProcess(cur);
     }
 
    return;
@@ -420,24 +794,21 @@ void makeDead (struct PCB * me)
  */
 struct TCB * getNextThread (void)
  {
-   static struct PCB * lp;
    struct PCB * a;
    struct TCB * b;
 
    if (scheduler == SCHEDULE_PROCESS)
     {
-      if ((lp != NULL) && (lp->threads == 0))
+      if ((Gcurp != NULL) && (Gcurp->threads == 0))
        {
 #ifdef INFANTICIDE
-         recInfanticide(lp);
-         free(lp->dmem);
-         free(lp);
-#else
-         appendList(&dpListHead, lp);
+         recInfanticide(Gcurp);
 #endif
+         buryProcess(Gcurp);
        }
       else
-         appendList(&pListHead, lp);
+         appendList(&pListHead, Gcurp);
+      Gcurp = NULL;
 
       if (deadLocked()) return NULL;
 
@@ -454,7 +825,7 @@ struct TCB * getNextThread (void)
        }
 
       b = removeFirst(&(a->readyList));
-      lp = a;
+      Gcurp = a;
     }
    else
     {
@@ -475,658 +846,4314 @@ void schedule (struct TCB * me)
    return;
  }
 
-/*
-   Creates a thread and schedules it.
-*/
-int createThread
-   (struct PCB * npar, int ** pr, int * npc, int ndp,
-    char * ncmem, int ** ns, int nsp)
+int futex (int * addr, int op, int val)
  {
-   struct TCB * c;
-   int i;
-
-   c = malloc(sizeof(struct TCB));
-
-   if (c != NULL)
-    {
-      npar->threads++;
+   return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+ }
 
-      c->next = NULL;
+ /*
+   OUTPUT
+      With -n, -m or -p, each thread puts what its '.'s print in a buffer
+      of its own, rather than have them all fight over stdout. Each '.'
+      takes a ticket, which orders it with every other thread's. When a
+      buffer fills, and at the end, all of them are emptied, and what they
+      had goes out in ticket order: the bytes come out in the order that
+      the '.'s were done in, as they would have on stdout. A '.' takes its
+      ticket with its buffer locked, so that when all of the buffers are
+      locked, they have every ticket since the last time, and nothing
+      after: the tickets to write out are all there, with none missing,
+      and each can be put right where it goes.
+      With -a, there are no tickets, or locks. A full buffer goes out by
+      itself, and only what each thread printed stays in order.
+      Green threads all print into one buffer, Gout, of -b bytes. A run of
+      '.'s is one fill. It goes out when it is full, at the end, and, as
+      -B says, at a newline (l) or before a ',' (i). The thread buffers
+      go out then, too.
+      With -W, going out is only a copy into a ring, and a writer thread
+      of its own empties the ring to stdout. Only a full ring waits. There
+      is only ever one producer: the green scheduler, or whoever holds
+      GoutLock. What printf() has for stdout waits for the ring to empty.
+      With -o, each process of the big bang, with its descendants, prints
+      to a stream of its own, a file or an fd, rather than to stdout. A
+      stream has its own buffer, of -b bytes, written out when it is full,
+      at the end, and before a fork.
+ */
+struct Put
+ {
+   unsigned long ticket;
+   long n; /* Times to print it */
+   int c;
+ };
 
-      c->par = npar;
+struct Outbuf
+ {
+   struct Outbuf * next;
+   pthread_mutex_t lock;
+   struct Put put [NPUT];
+   int len;
+ };
 
-      if (pr == NULL)
-         for (i = 0; i < NUMPROC; i++) c->procs[i] = NULL;
-      else
-         memcpy(c->procs, pr, NUMPROC * sizeof(int));
+char * Gout = NULL; /* The green threads' */
+size_t Goutlen = 0;
+size_t Goutcap = OUTSIZE;
+int Gflush = -1; /* When else to write it out: FLINE, FREAD */
+
+int Gbuffered = 0; /* Threads print through Outbufs */
+int Grelaxed = 0; /* In any order, with -a */
+unsigned long Gticket = 0;
+unsigned long Gwritten = 0; /* Tickets before this are out */
+struct Outbuf * Gouts = NULL; /* Everyone's, with GoutLock */
+struct Put * Gmerge = NULL; /* Where they are put in order */
+long Gmerges = 0;
+pthread_mutex_t GoutLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct Writer
+ {
+   char * b; /* The ring, WRITERSIZE bytes */
+   size_t head; /* Put in, by the producer */
+   size_t tail; /* Written out, by the writer */
+   int idle; /* The writer sleeps on it */
+   int full; /* The producer sleeps on it */
+   int stop;
+   pthread_t id;
+ };
 
-      c->pc = npc;
-      c->dp = ndp;
+struct Writer * Gwriter = NULL; /* With -W */
 
-      c->cmem = ncmem;
+struct Stream
+ {
+   pthread_mutex_t lock; /* With -n, -m or -p */
+   int fd;
+   char * b; /* Goutcap bytes */
+   size_t len;
+ };
 
-      if (ns != NULL) memcpy(c->stack, ns, STACKSIZE * sizeof(int));
+char * Groute = NULL; /* With -o: the streams' name, as name.0, name.1 */
+int GrouteFd = -1; /* Or, with -o &fd, the first stream's fd */
+struct Stream ** Gstreams = NULL; /* By process of the big bang */
+int Gnstreams = 0;
+int Gbang = 0; /* Processes of the big bang made so far */
 
-      c->sp = nsp;
+ /*
+   Writes it all to FD, itself.
+ */
+void writeOut (int fd, char * b, size_t n)
+ {
+   ssize_t w;
 
-      schedule(c);
+   while (n > 0)
+    {
+      w = write(fd, b, n);
+      if (w < 0)
+       {
+         if (errno == EINTR) continue;
+         return; /* Nobody is listening */
+       }
+      b += w;
+      n -= w;
     }
-
-   return (c == NULL);
+   return;
  }
 
-/*
-   Creates a process, creates its thread,
-       and adds it to the process list only if both succeeded.
-
-      Returns 0 on success and 1 on failure.
-*/
-int createProcess
-   (char * copymem, char * npmem, int ** nprocs,
-    int * npc, int ndp, int ** ns, int nsp)
+ /*
+   The writer thread: empties the ring, until told to stop.
+ */
+void * writerThread (void * arg)
  {
-   struct PCB * c;
-
-   c = malloc(sizeof(struct PCB));
+   struct Writer * r;
+   size_t h, t, n;
 
-   if (c != NULL)
+   r = arg;
+   t = r->tail;
+   while (1)
     {
-      c->next = NULL;
-
-      c->pmem = npmem;
-      c->dmem = malloc (DMEM * sizeof(char));
-
-      if (c->dmem != NULL)
+      h = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+      if (h == t)
        {
-         c->threads = 0;
-
-         if (!createThread(c, nprocs, npc, ndp, c->dmem, ns, nsp))
-          {
-            memcpy(c->dmem, copymem, DMEM * sizeof(char));
-
-            appendList(&pListHead, c);
-          }
-         else
+         __atomic_store_n(&r->idle, 1, __ATOMIC_SEQ_CST);
+         h = __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+         if (h == t)
           {
-            free(c->dmem);
-            free(c);
-
-            c = NULL;
+            if (__atomic_load_n(&r->stop, __ATOMIC_SEQ_CST)) break;
+            futex(&r->idle, FUTEX_WAIT, 1);
           }
+         __atomic_store_n(&r->idle, 0, __ATOMIC_SEQ_CST);
+         continue;
        }
-      else
-       {
-         free(c);
 
-         c = NULL;
+      n = WRITERSIZE - (t & (WRITERSIZE - 1)); /* Up to the end */
+      if (n > h - t) n = h - t;
+      writeOut(STDOUT_FILENO, r->b + (t & (WRITERSIZE - 1)), n);
+      t += n;
+      __atomic_store_n(&r->tail, t, __ATOMIC_SEQ_CST);
+
+      if (__atomic_load_n(&r->full, __ATOMIC_SEQ_CST))
+       {
+         __atomic_store_n(&r->full, 0, __ATOMIC_SEQ_CST);
+         futex(&r->full, FUTEX_WAKE, 1);
        }
     }
+   return NULL;
+ }
 
-   return (c == NULL);
+ /*
+   Waits until the writer has written out all but LEFT bytes.
+ */
+void writerWait (struct Writer * r, size_t left)
+ {
+   while (r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) > left)
+    {
+      __atomic_store_n(&r->full, 1, __ATOMIC_SEQ_CST);
+      if (r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) > left)
+         futex(&r->full, FUTEX_WAIT, 1);
+    }
+   return;
  }
 
-/*
-   Searches the list of threads waiting on semaphores to see if the increment
-   was on their semaphore. Yes, this is hella inefficient.
-*/
-void checkSemaphores (char * mem, int ptr)
+ /*
+   Puts N bytes at B into the ring, and rouses the writer.
+ */
+void writerPut (struct Writer * r, char * b, size_t n)
  {
-   struct TCB * this, * last;
+   size_t at, k;
 
-   last = NULL;
-   this = sListHead;
-   while (this != NULL)
+   while (n > 0)
     {
-      if ((this->dp == ptr) && (this->cmem == mem))
+      writerWait(r, WRITERSIZE - 1); /* Room for a byte, at least */
+      k = WRITERSIZE - (r->head - __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST));
+      at = r->head & (WRITERSIZE - 1);
+      if (k > WRITERSIZE - at) k = WRITERSIZE - at; /* Up to the end */
+      if (k > n) k = n;
+      memcpy(r->b + at, b, k);
+      __atomic_store_n(&r->head, r->head + k, __ATOMIC_SEQ_CST);
+      b += k;
+      n -= k;
+
+      if (__atomic_load_n(&r->idle, __ATOMIC_SEQ_CST))
        {
-         if (last == NULL) sListHead = sListHead->next;
-         else last->next = this->next;
-         this->next = NULL;
-         schedule(this);
-         return;
+         __atomic_store_n(&r->idle, 0, __ATOMIC_SEQ_CST);
+         futex(&r->idle, FUTEX_WAKE, 1);
        }
-      last = this;
-      this = this->next;
     }
    return;
  }
 
-/*
-   Execute a quanta of instructions...
-   Return:
-      0 Normal
-      1 Die
-      2 Sleep
-*/
-int doQuanta (struct TCB * me, int quanta)
+ /*
+   Starts the writer thread. Returns 1 if it couldn't.
+ */
+int writerStart (void)
  {
-   int cost = 1, curc, count, forever;
-
-   if (quanta == 0) forever = 1;
-   else forever = 0;
+   struct Writer * r;
 
-   while (forever || (quanta > 0))
+   r = calloc(1, sizeof(struct Writer));
+   if (r == NULL) return 1;
+   r->b = malloc(WRITERSIZE);
+   if ((r->b == NULL) || pthread_create(&r->id, NULL, writerThread, r))
     {
+      free(r->b);
+      free(r);
+      return 1;
+    }
+   Gwriter = r;
+   return 0;
+ }
 
-      curc = *me->pc;
-      me->pc++;
-
-#ifdef DEBUG
-      fprintf(stderr, "%p : %c  %d\n", me, curc & IMASK, curc >> SHIFT);
-#endif
+ /*
+   Lets the writer write out what it has, and stops it.
+ */
+void writerStop (void)
+ {
+   struct Writer * r;
 
-      switch (curc & IMASK)
-       {
-         case '+':
-            me->cmem[me->dp] += curc >> SHIFT;
-            break;
+   r = Gwriter;
+   if (r == NULL) return;
+   Gwriter = NULL;
 
-         case '-':
-            me->cmem[me->dp] -= curc >> SHIFT;
-            break;
+   __atomic_store_n(&r->stop, 1, __ATOMIC_SEQ_CST);
+   __atomic_store_n(&r->idle, 0, __ATOMIC_SEQ_CST);
+   futex(&r->idle, FUTEX_WAKE, 1);
+   pthread_join(r->id, NULL);
 
-         case '>':
-            me->dp = (me->dp + (curc >> SHIFT)) & DMASK;
-            break;
+   free(r->b);
+   free(r);
+   return;
+ }
 
-         case '<':
-            me->dp = (me->dp - (curc >> SHIFT)) & DMASK;
-            break;
+ /*
+   Writes it all to stdout, and what stdout has, first: itself, or
+   through the writer.
+ */
+void writeAll (char * b, size_t n)
+ {
+   if (Gwriter == NULL)
+    {
+      fflush(stdout);
+      writeOut(STDOUT_FILENO, b, n);
+      return;
+    }
 
-         case '.':
-            curc >>= SHIFT;
-            while (curc--)
-               fputc(me->cmem[me->dp], stdout);
-            break;
+   if (__fpending(stdout) > 0) /* A '#' printed it: after the ring */
+    {
+      writerWait(Gwriter, 0);
+      fflush(stdout);
+    }
+   writerPut(Gwriter, b, n);
+   return;
+ }
 
-         case ',':
-            count = curc >> SHIFT;
-            while (count--)
-             {
-               curc = fgetc(useIn);
-               if (curc != EOF) me->cmem[me->dp] = curc;
-             }
-            break;
+ /*
+   Writes out N puts.
+ */
+void writePuts (struct Put * p, long n)
+ {
+   char b [65536];
+   size_t len;
+   long i, k, run;
 
-         case '[':
-         case '(':
-            if (me->cmem[me->dp] == 0)
-               me->pc += curc >> SHIFT;
-            break;
+   len = 0;
+   for (i = 0; i < n; i++)
+    {
+      k = p[i].n;
+      if ((k == 1) && (len < sizeof(b))) /* The usual */
+       {
+         b[len++] = p[i].c;
+         continue;
+       }
 
-         case '}':
-            if (me->cmem[me->dp] == 0)
-               me->pc -= curc >> SHIFT;
-            break;
+      for (; k > 0; k -= run)
+       {
+         if (len == sizeof(b))
+          {
+            writeAll(b, len);
+            len = 0;
+          }
+         run = (k < (long) (sizeof(b) - len)) ? k : (long) (sizeof(b) - len);
+         memset(b + len, p[i].c, run);
+         len += run;
+       }
+    }
+   writeAll(b, len);
+   return;
+ }
 
-         case ']':
-            if (me->cmem[me->dp] != 0)
-               me->pc -= curc >> SHIFT;
-            break;
+ /*
+   Writes out what the green threads printed.
+ */
+void flushOut (void)
+ {
+   writeAll(Gout, Goutlen);
+   Goutlen = 0;
+   return;
+ }
 
-         case '{':
-            if (me->cmem[me->dp] != 0)
-               me->pc += curc >> SHIFT;
-            break;
+ /*
+   A green thread prints C, N times.
+ */
+void putOut (int c, long n)
+ {
+   long run;
 
-         case ':':
-            count = procNum(*me->pc);
-            if (count != NOPROC)
-               me->procs[count] = me->pc + 1;
+   if ((n == 1) && (Goutlen < Goutcap)) /* The usual */
+      Gout[Goutlen++] = c;
+   else
+      for (; n > 0; n -= run)
+       {
+         if (Goutlen == Goutcap) flushOut();
+         run = (n < (long) (Goutcap - Goutlen)) ? n : (long) (Goutcap - Goutlen);
+         memset(Gout + Goutlen, c, run);
+         Goutlen += run;
+       }
 
-         case '|':
-            me->pc += curc >> SHIFT;
-            break;
+   if ((Goutlen == Goutcap) || ((c == '\n') && (Gflush & FLINE))) flushOut();
+   return;
+ }
 
-         case '&':
-            me->cmem[me->dp] = 0;
-            me->cmem[(me->dp + 1) & DMASK] = 1;
-            if (createThread(me->par, me->procs, me->pc, (me->dp + 1) & DMASK,
-                             me->cmem, me->stack, me->sp))
-               me->cmem[(me->dp + 1) & DMASK] = 0;
-            break;
+ /*
+   A green thread prints the N bytes at B. With -B l, it is written out up
+   to the last newline in it.
+ */
+void putString (char * b, long n)
+ {
+   char * nl;
+   long run;
 
-         case '%':
-            me->cmem[me->dp] = 0;
-            me->cmem[(me->dp + 1) & DMASK] = 1;
-            if (createProcess(me->cmem, me->par->dmem, me->procs, me->pc,
-                              (me->dp + 1) & DMASK, me->stack, me->sp))
-               me->cmem[(me->dp + 1) & DMASK] = 0;
-            break;
+   nl = (Gflush & FLINE) ? memrchr(b, '\n', n) : NULL;
+   while (n > 0)
+    {
+      if (Goutlen == Goutcap) flushOut();
+      run = (n < (long) (Goutcap - Goutlen)) ? n : (long) (Goutcap - Goutlen);
+      memcpy(Gout + Goutlen, b, run);
+      Goutlen += run;
+      b += run;
+      n -= run;
+      if ((nl != NULL) && (b > nl))
+       {
+         flushOut();
+         nl = NULL;
+       }
+    }
 
-         case '^':
-            count = curc >> SHIFT;
-            me->cmem[me->dp] += count;
-            while (count--)
-               if (sListHead != NULL)
-                  checkSemaphores(me->cmem, me->dp);
-            break;
+   if (Goutlen == Goutcap) flushOut();
+   return;
+ }
 
-         case '_':
-            if (me->cmem[me->dp] < (curc >> SHIFT))
-             {
-               me->pc--; /* Re-try the down. */
-               return 2;
-             }
-            else
-               me->cmem[me->dp] -= curc >> SHIFT;
-            break;
+ /*
+   Empties every buffer, in ticket order. With -a, only MINE.
+ */
+void outFlush (struct Outbuf * mine)
+ {
+   struct Outbuf * o;
+   struct Put * m;
+   long n, i;
 
-         case '*':
-            return 0;
+   pthread_mutex_lock(&GoutLock);
+   if (Grelaxed)
+    {
+      if (mine != NULL)
+       {
+         writePuts(mine->put, mine->len);
+         mine->len = 0;
+       }
+      pthread_mutex_unlock(&GoutLock);
+      return;
+    }
+
+   n = 0;
+   for (o = Gouts; o != NULL; o = o->next)
+    {
+      pthread_mutex_lock(&o->lock);
+      n += o->len;
+    }
+
+   if (n > Gmerges)
+    {
+      m = realloc(Gmerge, n * sizeof(struct Put));
+      if (m != NULL)
+       {
+         Gmerge = m;
+         Gmerges = n;
+       }
+    }
+
+   for (o = Gouts; o != NULL; o = o->next)
+    {
+      if (n <= Gmerges)
+         for (i = 0; i < o->len; i++)
+            Gmerge[o->put[i].ticket - Gwritten] = o->put[i];
+      else
+         writePuts(o->put, o->len); /* No mem to put them in order */
+      o->len = 0;
+      pthread_mutex_unlock(&o->lock);
+    }
+
+   if (n <= Gmerges) writePuts(Gmerge, n);
+   Gwritten += n;
+   pthread_mutex_unlock(&GoutLock);
+   return;
+ }
+
+ /*
+   Prints C, N times, from thread ME.
+ */
+void outPut (struct TCB * me, int c, long n)
+ {
+   struct Outbuf * o;
+   int full;
+
+   o = me->out;
+   if (o == NULL)
+    {
+      o = malloc(sizeof(struct Outbuf));
+      if (o == NULL)
+       {
+         fprintf(stderr, "err: no mem for output\n");
+         return;
+       }
+      pthread_mutex_init(&o->lock, NULL);
+      o->len = 0;
+      pthread_mutex_lock(&GoutLock);
+      o->next = Gouts;
+      Gouts = o;
+      pthread_mutex_unlock(&GoutLock);
+      me->out = o;
+    }
+
+   if (Grelaxed)
+    {
+      o->put[o->len].n = n;
+      o->put[o->len].c = c;
+      if ((++o->len == NPUT) || ((c == '\n') && (Gflush & FLINE)))
+         outFlush(o);
+      return;
+    }
+
+   pthread_mutex_lock(&o->lock);
+   o->put[o->len].ticket = __atomic_fetch_add(&Gticket, 1, __ATOMIC_SEQ_CST);
+   o->put[o->len].n = n;
+   o->put[o->len].c = c;
+   full = (++o->len == NPUT) || ((c == '\n') && (Gflush & FLINE));
+   pthread_mutex_unlock(&o->lock);
+
+   if (full) outFlush(o);
+   return;
+ }
+
+ /*
+   Thread ME is done printing. With -a, what it has goes out now.
+   Otherwise, it waits for the others' in its buffer, unless there is
+   nothing in it.
+ */
+void outDone (struct TCB * me)
+ {
+   struct Outbuf ** o;
+
+   if (me->out == NULL) return;
+   if (Grelaxed) outFlush(me->out);
+
+   pthread_mutex_lock(&GoutLock);
+   if (me->out->len == 0)
+    {
+      for (o = &Gouts; *o != me->out; o = &(*o)->next)
+         ;
+      *o = me->out->next;
+      pthread_mutex_destroy(&me->out->lock);
+      free(me->out);
+    }
+   pthread_mutex_unlock(&GoutLock);
+   me->out = NULL;
+   return;
+ }
+
+ /*
+   Everyone is done: everything goes out.
+ */
+void outEnd (void)
+ {
+   struct Outbuf * o;
+
+   if (!Grelaxed)
+      outFlush(NULL);
+   else
+      for (o = Gouts; o != NULL; o = o->next)
+         writePuts(o->put, o->len);
+
+   while ((o = removeFirst((void **) &Gouts)) != NULL)
+    {
+      pthread_mutex_destroy(&o->lock);
+      free(o);
+    }
+   free(Gmerge);
+   Gmerge = NULL;
+   Gmerges = 0;
+   Gticket = Gwritten = 0;
+   return;
+ }
+
+ /*
+   The stream of the Nth process of the big bang, opened the first time
+   that it is asked for. Returns NULL if there is no mem for it: then
+   what the process prints is lost.
+ */
+struct Stream * streamFor (int n)
+ {
+   struct Stream ** all, * s;
+   char * name;
+
+   if (n >= Gnstreams)
+    {
+      all = realloc(Gstreams, (n + 1) * sizeof(struct Stream *));
+      if (all == NULL)
+       {
+         fprintf(stderr, "err: no mem for stream %d\n", n);
+         return NULL;
+       }
+      for (; Gnstreams <= n; Gnstreams++) all[Gnstreams] = NULL;
+      Gstreams = all;
+    }
+   if (Gstreams[n] != NULL) return Gstreams[n];
+
+   s = malloc(sizeof(struct Stream));
+   if (s != NULL) s->b = malloc(Goutcap);
+   if ((s == NULL) || (s->b == NULL))
+    {
+      fprintf(stderr, "err: no mem for stream %d\n", n);
+      free(s);
+      return NULL;
+    }
+   pthread_mutex_init(&s->lock, NULL);
+   s->len = 0;
+
+   if (GrouteFd >= 0)
+      s->fd = GrouteFd + n;
+   else
+    {
+      name = malloc(strlen(Groute) + 16);
+      if (name != NULL) sprintf(name, "%s.%d", Groute, n);
+      s->fd = (name == NULL) ? -1 :
+         open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+      if (s->fd < 0)
+       {
+         fprintf(stderr, "err: can't open \"%s\": printing to stdout\n",
+            (name == NULL) ? Groute : name);
+         s->fd = STDOUT_FILENO;
+       }
+      free(name);
+    }
+
+   Gstreams[n] = s;
+   return s;
+ }
+
+ /*
+   A process prints C, N times, to stream S.
+ */
+void streamPut (struct Stream * s, int c, long n)
+ {
+   long run;
+
+   if (s == NULL) return;
+   if (Gbuffered) pthread_mutex_lock(&s->lock);
+   if ((n == 1) && (s->len < Goutcap)) /* The usual */
+      s->b[s->len++] = c;
+   else
+      for (; n > 0; n -= run)
+       {
+         if (s->len == Goutcap)
+          {
+            writeOut(s->fd, s->b, s->len);
+            s->len = 0;
+          }
+         run = (n < (long) (Goutcap - s->len)) ? n : (long) (Goutcap - s->len);
+         memset(s->b + s->len, c, run);
+         s->len += run;
+       }
+
+   if (s->len == Goutcap)
+    {
+      writeOut(s->fd, s->b, s->len);
+      s->len = 0;
+    }
+   if (Gbuffered) pthread_mutex_unlock(&s->lock);
+   return;
+ }
+
+ /*
+   A process prints the N bytes at B to stream S.
+ */
+void streamString (struct Stream * s, char * b, long n)
+ {
+   long run;
+
+   if (s == NULL) return;
+   if (Gbuffered) pthread_mutex_lock(&s->lock);
+   while (n > 0)
+    {
+      if (s->len == Goutcap)
+       {
+         writeOut(s->fd, s->b, s->len);
+         s->len = 0;
+       }
+      run = (n < (long) (Goutcap - s->len)) ? n : (long) (Goutcap - s->len);
+      memcpy(s->b + s->len, b, run);
+      s->len += run;
+      b += run;
+      n -= run;
+    }
+
+   if (s->len == Goutcap)
+    {
+      writeOut(s->fd, s->b, s->len);
+      s->len = 0;
+    }
+   if (Gbuffered) pthread_mutex_unlock(&s->lock);
+   return;
+ }
+
+ /*
+   Writes out what every stream has.
+ */
+void flushStreams (void)
+ {
+   int i;
+
+   for (i = 0; i < Gnstreams; i++)
+      if ((Gstreams[i] != NULL) && (Gstreams[i]->len > 0))
+       {
+         writeOut(Gstreams[i]->fd, Gstreams[i]->b, Gstreams[i]->len);
+         Gstreams[i]->len = 0;
+       }
+   return;
+ }
+
+ /*
+   Done with the streams: closes the files.
+ */
+void closeStreams (void)
+ {
+   int i;
+
+   flushStreams();
+   for (i = 0; i < Gnstreams; i++)
+      if (Gstreams[i] != NULL)
+       {
+         if ((GrouteFd < 0) && (Gstreams[i]->fd != STDOUT_FILENO))
+            close(Gstreams[i]->fd);
+         pthread_mutex_destroy(&Gstreams[i]->lock);
+         free(Gstreams[i]->b);
+         free(Gstreams[i]);
+       }
+   free(Gstreams);
+   Gstreams = NULL;
+   Gnstreams = 0;
+   return;
+ }
+
+ /*
+   NATIVE THREADS
+      With -n, every brains thread is an OS thread, and they all run at once.
+      With -m, the brains threads stay green, but there is a worker thread
+      for every core to run them. Each worker has a deque of ready threads:
+      it runs the one at the head for a quanta, and puts it back at the
+      tail. A worker with nothing to do steals the head of another's deque.
+
+      A thread that can't '_' sleeps in the bucket of its cell, and a '^'
+      wakes the threads sleeping on that cell, and no others. An OS thread
+      first spins on the cell for a while, then sleeps on a futex of its
+      own. A green one sleeps without a worker, and is woken onto the
+      deque of the worker that woke it.
+      With -p, a family is a process of the big bang and its descendants,
+      run by the green scheduler on an OS thread of its own. Only a '_' on
+      the system memory sleeps in a bucket: the '^' that wakes it sends it
+      home, to be scheduled there again. A family with nothing to run but
+      such sleepers waits for them.
+      The threads alive and asleep are counted in one word, so that
+      whoever makes them equal knows that nothing can ever wake up again.
+      With -p, it's families that are counted, rather than threads.
+ */
+struct Bucket
+ {
+   pthread_mutex_t lock;
+   struct TCB * sleepers;
+   int waiters; /* Sleepers, and threads on their way in */
+   int spin; /* How long spinning took to work, lately */
+ };
+
+struct Bucket Gbuckets [NBUCKET];
+
+struct Worker
+ {
+   pthread_mutex_t lock;
+   struct TCB * head, * tail; /* The deque */
+   pthread_t id;
+   unsigned int seed;
+ };
+
+struct Worker * Gworker = NULL;
+int Gworkers = 0;
+__thread struct Worker * Gself = NULL; /* The worker I am, if I am one */
+int Gnext = 0; /* Where the next of the big bang goes */
+int Gslice; /* The workers' (or families') quanta */
+
+struct Family
+ {
+   pthread_mutex_t lock;
+   pthread_cond_t wake;
+   struct TCB * inbox; /* Woken threads, to schedule again */
+   int asleep; /* Waiting on the inbox, and counted so in Grun */
+   int out; /* My threads asleep in buckets, or in the inbox */
+   struct PCB * big; /* The big bang of the family */
+   pthread_t id;
+ };
+
+struct Family * Gfamily = NULL;
+__thread struct Family * Ghome = NULL; /* With -p, the family I run */
+
+unsigned long Grun = 0; /* Live threads, plus ASLEEP for each sleeping one */
+int Gstop = 0; /* Deadlocked: everyone leaves */
+
+pthread_mutex_t GdoneLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Gdone = PTHREAD_COND_INITIALIZER;
+
+int Gcores;
+
+int Gidlers = 0; /* Workers waiting for something to do */
+pthread_mutex_t GidleLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Gidle = PTHREAD_COND_INITIALIZER;
+
+pthread_attr_t Gattr;
+
+ /*
+   Sets up the buckets, and the workers' deques. Returns 0 on success.
+ */
+int initNative (void)
+ {
+   int i;
+
+   for (i = 0; i < NBUCKET; i++)
+    {
+      pthread_mutex_init(&Gbuckets[i].lock, NULL);
+      Gbuckets[i].sleepers = NULL;
+      Gbuckets[i].waiters = 0;
+      Gbuckets[i].spin = 0;
+    }
+
+   Gcores = sysconf(_SC_NPROCESSORS_ONLN);
+
+   pthread_attr_init(&Gattr);
+   pthread_attr_setdetachstate(&Gattr, PTHREAD_CREATE_DETACHED);
+   pthread_attr_setstacksize(&Gattr, NSTACK);
+
+   if (Gnative == WORKERS)
+    {
+      if (Gworkers == 0) Gworkers = Gcores;
+      if (Gworkers < 1) Gworkers = 1;
+
+      Gworker = calloc(Gworkers, sizeof(struct Worker));
+      if (Gworker == NULL) return 1;
+
+      for (i = 0; i < Gworkers; i++)
+       {
+         pthread_mutex_init(&Gworker[i].lock, NULL);
+         Gworker[i].seed = i + 1;
+       }
+    }
+   return 0;
+ }
+
+struct Bucket * bucket (char * mem, long dp)
+ {
+   return Gbuckets + (((unsigned long) mem / Gwidth + dp) & (NBUCKET - 1));
+ }
+
+ /*
+   Is the cell at least want? Reads it the way '_' would.
+ */
+int cellReady (char * mem, long dp, long want)
+ {
+   if (Gwidth == 4)
+      return __atomic_load_n((int *) mem + dp, __ATOMIC_SEQ_CST) >= want;
+   if (Gwidth == 2)
+      return __atomic_load_n((short *) mem + dp, __ATOMIC_SEQ_CST) >= want;
+   return __atomic_load_n(mem + dp, __ATOMIC_SEQ_CST) >= want;
+ }
+
+ /*
+   Wakes a sleeping OS thread. It may be up, and even gone, before the
+   wake: then the wake finds nobody, or someone who checks and sleeps on.
+ */
+void rouse (struct TCB * t)
+ {
+   __atomic_store_n(&t->asleep, 0, __ATOMIC_RELEASE);
+   futex(&t->asleep, FUTEX_WAKE_PRIVATE, 1);
+   return;
+ }
+
+ /*
+   Tells the main thread, and idle workers, that the last thread is gone.
+ */
+void finish (void)
+ {
+   pthread_mutex_lock(&GdoneLock);
+   pthread_cond_broadcast(&Gdone);
+   pthread_mutex_unlock(&GdoneLock);
+
+   pthread_mutex_lock(&GidleLock);
+   pthread_cond_broadcast(&Gidle);
+   pthread_mutex_unlock(&GidleLock);
+   return;
+ }
+
+ /*
+   A native thread is done: the last one out buries the process.
+   INFANTICIDE isn't done here: the children are running on their own.
+ */
+void endThread (struct TCB * me)
+ {
+   outDone(me);
+   if (__atomic_sub_fetch(&me->par->threads, 1, __ATOMIC_ACQ_REL) == 0)
+      buryProcess(me->par);
+   free(me);
+   return;
+ }
+
+ /*
+   Sends a woken thread back to its family.
+ */
+void sendHome (struct TCB * t)
+ {
+   struct Family * f;
+
+   f = t->par->home;
+   pthread_mutex_lock(&f->lock);
+   t->next = f->inbox;
+   f->inbox = t;
+   if (f->asleep)
+    {
+      f->asleep = 0;
+      __atomic_sub_fetch(&Grun, ASLEEP, __ATOMIC_SEQ_CST);
+    }
+   pthread_cond_signal(&f->wake);
+   pthread_mutex_unlock(&f->lock);
+   return;
+ }
+
+ /*
+   Ends everyone, when nothing else can. Sleeping OS threads are woken to
+   leave by themselves, and families' are sent home. Other green ones are
+   just ended.
+ */
+void stopAll (void)
+ {
+   struct TCB * t, * n;
+   int i;
+
+   __atomic_store_n(&Gstop, 1, __ATOMIC_SEQ_CST);
+   for (i = 0; i < NBUCKET; i++)
+    {
+      pthread_mutex_lock(&Gbuckets[i].lock);
+      t = Gbuckets[i].sleepers;
+      Gbuckets[i].sleepers = NULL;
+      Gbuckets[i].waiters = 0;
+      pthread_mutex_unlock(&Gbuckets[i].lock);
+
+      for (; t != NULL; t = n)
+       {
+         n = t->next;
+         if (Gnative == OSTHREADS)
+          {
+            __atomic_sub_fetch(&Grun, ASLEEP, __ATOMIC_SEQ_CST);
+            rouse(t);
+          }
+         else if (Gnative == FAMILIES)
+            sendHome(t); /* To be freed there */
+         else
+          {
+            endThread(t);
+            if (__atomic_sub_fetch(&Grun, ASLEEP + 1, __ATOMIC_SEQ_CST) == 0)
+               finish();
+          }
+       }
+    }
+   return;
+ }
+
+ /*
+   Counts threads in and out of Grun, and notices the end.
+ */
+void runCount (long change)
+ {
+   unsigned long now;
+
+   now = __atomic_add_fetch(&Grun, change, __ATOMIC_SEQ_CST);
+   if (now == 0)
+      finish();
+   else if ((now / ASLEEP == now % ASLEEP) && !Gstop)
+      stopAll();
+   return;
+ }
+
+ /*
+   Can other threads get at my current segment? Only my own '&', '%' and '~'
+   can make a private segment shared: when the others are gone, it's only
+   noticed at the next quanta.
+ */
+int sharedSeg (struct TCB * me)
+ {
+   if ((Gnative == FAMILIES) || (Gnative == SHARDS))
+      return me->cmem == Gsmem;
+   if (Gnative == FORKS)
+      return (me->cmem != me->par->dmem) || (me->par->forks > 0);
+   if (me->cmem != me->par->dmem) return 1;
+   return (__atomic_load_n(&me->par->threads, __ATOMIC_ACQUIRE) > 1) ||
+          (__atomic_load_n(&me->par->refs, __ATOMIC_ACQUIRE) > 1);
+ }
+
+ /*
+   Puts a thread in its cell's bucket, unless the cell already has what it
+   wants. Returns 1 if it did: the bucket is still locked. The caller
+   re-tries the '_' either way, once the thread is woken.
+ */
+int sleepOn (struct Bucket * b, struct TCB * me)
+ {
+   unsigned long now;
+
+   pthread_mutex_lock(&b->lock);
+   __atomic_add_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+
+   if (cellReady(me->cmem, me->dp, me->want))
+    {
+      __atomic_sub_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&b->lock);
+      return 0;
+    }
+
+   me->next = b->sleepers;
+   b->sleepers = me;
+   me->asleep = 1;
+   if (Gnative == FAMILIES) return 1; /* Families count themselves */
+
+   now = __atomic_add_fetch(&Grun, ASLEEP, __ATOMIC_SEQ_CST);
+   if ((now / ASLEEP == now % ASLEEP) && !Gstop)
+    {
+      pthread_mutex_unlock(&b->lock);
+      stopAll();
+      pthread_mutex_lock(&b->lock);
+    }
+   return 1;
+ }
+
+ /*
+   Spins on the cell for a while, hoping it comes up. How long depends on
+   how long it took, lately, in this bucket. Returns 1 if it came up.
+ */
+int spinFor (struct Bucket * b, struct TCB * me)
+ {
+   int i, spin, limit;
+
+   if (Gcores < 2) return 0; /* Nobody can put it up while I spin. */
+
+   spin = __atomic_load_n(&b->spin, __ATOMIC_RELAXED);
+   limit = 2 * spin + SPINMIN;
+   if (limit > SPINMAX) limit = SPINMAX;
+
+   for (i = 0; i < limit; i++)
+    {
+      if (cellReady(me->cmem, me->dp, me->want))
+       {
+         __atomic_store_n(&b->spin, spin + (i - spin) / 8, __ATOMIC_RELAXED);
+         return 1;
+       }
+      RELAX();
+    }
+
+   spin -= spin / 8 + 1;
+   __atomic_store_n(&b->spin, (spin > 0) ? spin : 0, __ATOMIC_RELAXED);
+   return 0;
+ }
+
+ /*
+   Puts an OS thread to sleep on its cell, after a spin.
+ */
+void parkThread (struct TCB * me)
+ {
+   struct Bucket * b;
+
+   b = bucket(me->cmem, me->dp);
+   if (spinFor(b, me) || !sleepOn(b, me)) return;
+   pthread_mutex_unlock(&b->lock);
+
+   while (__atomic_load_n(&me->asleep, __ATOMIC_ACQUIRE))
+      futex(&me->asleep, FUTEX_WAIT_PRIVATE, 1);
+   return;
+ }
+
+ /*
+   Puts a thread at the tail of my deque, or, from outside of the workers,
+   at the tail of the next one's. Wakes an idle worker to come and get it.
+ */
+void pushWork (struct TCB * t)
+ {
+   struct Worker * w;
+
+   w = Gself;
+   if (w == NULL) w = Gworker + Gnext++ % Gworkers;
+
+   t->next = NULL;
+   pthread_mutex_lock(&w->lock);
+   if (w->head == NULL)
+      __atomic_store_n(&w->head, t, __ATOMIC_SEQ_CST); /* Idlers look */
+   else
+      w->tail->next = t;
+   w->tail = t;
+   pthread_mutex_unlock(&w->lock);
+
+   if (__atomic_load_n(&Gidlers, __ATOMIC_SEQ_CST) > 0)
+    {
+      pthread_mutex_lock(&GidleLock);
+      pthread_cond_signal(&Gidle);
+      pthread_mutex_unlock(&GidleLock);
+    }
+   return;
+ }
+
+ /*
+   Takes the thread at the head of a deque.
+ */
+struct TCB * popWork (struct Worker * w)
+ {
+   struct TCB * t;
+
+   if (__atomic_load_n(&w->head, __ATOMIC_RELAXED) == NULL) return NULL;
+
+   pthread_mutex_lock(&w->lock);
+   t = w->head;
+   if (t != NULL)
+    {
+      __atomic_store_n(&w->head, t->next, __ATOMIC_RELEASE);
+      t->next = NULL;
+    }
+   pthread_mutex_unlock(&w->lock);
+   return t;
+ }
+
+ /*
+   My own work first, then anyone else's.
+ */
+struct TCB * findWork (struct Worker * me)
+ {
+   struct TCB * t;
+   int i;
+
+   t = popWork(me);
+   for (i = 1; (t == NULL) && (i < Gworkers); i++)
+      t = popWork(Gworker + (me - Gworker + i) % Gworkers);
+   return t;
+ }
+
+int anyWork (void)
+ {
+   int i;
+
+   for (i = 0; i < Gworkers; i++)
+      if (__atomic_load_n(&Gworker[i].head, __ATOMIC_SEQ_CST) != NULL)
+         return 1;
+   return 0;
+ }
+
+ /*
+   Waits for work. Returns 1 when there will never be any more.
+ */
+int idle (void)
+ {
+   pthread_mutex_lock(&GidleLock);
+   __atomic_add_fetch(&Gidlers, 1, __ATOMIC_SEQ_CST);
+   while ((__atomic_load_n(&Grun, __ATOMIC_SEQ_CST) != 0) && !anyWork())
+      pthread_cond_wait(&Gidle, &GidleLock);
+   __atomic_sub_fetch(&Gidlers, 1, __ATOMIC_SEQ_CST);
+   pthread_mutex_unlock(&GidleLock);
+
+   return __atomic_load_n(&Grun, __ATOMIC_SEQ_CST) == 0;
+ }
+
+ /*
+   Puts a green thread to sleep on its cell. Its worker moves on.
+ */
+void parkWork (struct TCB * me)
+ {
+   struct Bucket * b;
+
+   b = bucket(me->cmem, me->dp);
+   if (sleepOn(b, me))
+      pthread_mutex_unlock(&b->lock); /* I may be gone already. */
+   else
+      pushWork(me);
+   return;
+ }
+
+ /*
+   Wakes all of the threads sleeping on a cell that just went up.
+ */
+void wakeCell (char * mem, long dp)
+ {
+   struct Bucket * b;
+   struct TCB ** t, * woke, * w;
+
+   b = bucket(mem, dp);
+   if (__atomic_load_n(&b->waiters, __ATOMIC_SEQ_CST) == 0) return;
+
+   woke = NULL;
+   pthread_mutex_lock(&b->lock);
+   t = &b->sleepers;
+   while (*t != NULL)
+      if (((*t)->cmem == mem) && ((*t)->dp == dp))
+       {
+         w = *t;
+         *t = w->next;
+         w->next = woke;
+         woke = w;
+         __atomic_sub_fetch(&b->waiters, 1, __ATOMIC_SEQ_CST);
+         if (Gnative != FAMILIES)
+            __atomic_sub_fetch(&Grun, ASLEEP, __ATOMIC_SEQ_CST);
+       }
+      else
+         t = &(*t)->next;
+   pthread_mutex_unlock(&b->lock);
+
+   for (; woke != NULL; woke = w)
+    {
+      w = woke->next;
+      if (Gnative == OSTHREADS)
+         rouse(woke);
+      else if (Gnative == FAMILIES)
+         sendHome(woke);
+      else
+       {
+         woke->asleep = 0;
+         pushWork(woke);
+       }
+    }
+   return;
+ }
+
+ /*
+   Puts a family's thread to sleep on a cell of the system memory.
+ */
+void parkHome (struct TCB * me)
+ {
+   struct Bucket * b;
+
+   b = bucket(me->cmem, me->dp);
+   if (sleepOn(b, me))
+    {
+      pthread_mutex_unlock(&b->lock);
+      me->par->home->out++;
+    }
+   else
+      schedule(me);
+   return;
+ }
+
+ /*
+   Takes whoever has been sent home since I last looked, without waiting,
+   so that a thread that was woken runs even while others keep the family
+   busy.
+ */
+void takeHome (struct Family * f)
+ {
+   struct TCB * t, * n;
+
+   if (__atomic_load_n(&f->inbox, __ATOMIC_ACQUIRE) == NULL) return;
+
+   pthread_mutex_lock(&f->lock);
+   if (__atomic_load_n(&Gstop, __ATOMIC_SEQ_CST))
+      t = NULL; /* Deadlocked: waitHome takes them */
+   else
+    {
+      t = f->inbox;
+      f->inbox = NULL;
+    }
+   pthread_mutex_unlock(&f->lock);
+
+   for (; t != NULL; t = n)
+    {
+      n = t->next;
+      t->next = NULL;
+      f->out--;
+      schedule(t);
+    }
+   return;
+ }
+
+ /*
+   Waits for the family's sleepers to be sent home, and takes them.
+ */
+struct TCB * waitHome (struct Family * f)
+ {
+   struct TCB * t;
+   unsigned long now;
+
+   pthread_mutex_lock(&f->lock);
+   if ((f->inbox == NULL) && !__atomic_load_n(&Gstop, __ATOMIC_SEQ_CST))
+    {
+      f->asleep = 1;
+      now = __atomic_add_fetch(&Grun, ASLEEP, __ATOMIC_SEQ_CST);
+      if ((now / ASLEEP == now % ASLEEP) && !Gstop)
+       {
+         pthread_mutex_unlock(&f->lock);
+         stopAll();
+         pthread_mutex_lock(&f->lock);
+       }
+    }
+   while (f->inbox == NULL)
+      pthread_cond_wait(&f->wake, &f->lock);
+   t = f->inbox;
+   f->inbox = NULL;
+   pthread_mutex_unlock(&f->lock);
+   return t;
+ }
+
+void * nativeThread (void * arg)
+ {
+   struct TCB * me;
+   int c;
+
+   me = arg;
+   do
+    {
+      c = doQuanta(me, 0);
+      if (c == 0)
+         sched_yield();
+      else if (c == 2)
+         parkThread(me);
+    }
+   while ((c != 1) && !__atomic_load_n(&Gstop, __ATOMIC_SEQ_CST));
+
+   endThread(me);
+   runCount(-1);
+   return NULL;
+ }
+
+void * workerThread (void * arg)
+ {
+   struct TCB * t;
+   int c;
+
+   Gself = arg;
+   do
+      while ((t = findWork(Gself)) != NULL)
+       {
+         if (Gslice < 0)
+            c = (rand_r(&Gself->seed) & 127) + 1;
+         else
+            c = Gslice;
+
+         switch (doQuanta(t, c))
+          {
+            case 0:
+               pushWork(t);
+               break;
+
+            case 1:
+               endThread(t);
+               runCount(-1);
+               break;
+
+            case 2:
+               parkWork(t);
+               break;
+          }
+       }
+   while (!idle());
+
+   Gself = NULL;
+   return NULL;
+ }
+
+ /*
+   Starts a brains thread: on an OS thread of its own, or on a deque.
+   Returns 0 on success.
+ */
+int startThread (struct TCB * me)
+ {
+   pthread_t id;
+
+   __atomic_add_fetch(&Grun, 1, __ATOMIC_SEQ_CST);
+   if (Gnative == WORKERS)
+    {
+      pushWork(me);
+      return 0;
+    }
+   if (pthread_create(&id, &Gattr, nativeThread, me) == 0) return 0;
+   __atomic_sub_fetch(&Grun, 1, __ATOMIC_SEQ_CST);
+   return 1;
+ }
+
+/*
+   Waits for the native threads to finish.
+*/
+void executeNative (void)
+ {
+   runCount(-1); /* The big bang is running: I'm out */
+
+   pthread_mutex_lock(&GdoneLock);
+   while (__atomic_load_n(&Grun, __ATOMIC_SEQ_CST) != 0)
+      pthread_cond_wait(&Gdone, &GdoneLock);
+   pthread_mutex_unlock(&GdoneLock);
+
+   outEnd();
+   Gstop = 0;
+   return;
+ }
+
+/*
+   Runs the green threads on the workers. I am the first of them.
+*/
+void executeWorkers (int quanta)
+ {
+   int i, n;
+
+   Gslice = quanta;
+   for (n = 1; n < Gworkers; n++)
+      if (pthread_create(&Gworker[n].id, NULL, workerThread, Gworker + n))
+         break; /* The rest of the deques just get stolen from. */
+
+   runCount(-1); /* The big bang is in the deques */
+   workerThread(Gworker);
+
+   for (i = 1; i < n; i++)
+      pthread_join(Gworker[i].id, NULL);
+
+   outEnd();
+   Gstop = 0;
+   Gnext = 0;
+   return;
+ }
+
+ /*
+   Are new threads run here, by the green scheduler?
+ */
+int greenHere (void)
+ {
+   return (Gnative != OSTHREADS) && (Gnative != WORKERS);
+ }
+
+ /*
+   FORKED PROCESSES
+      With -f, every '%' forks, and each OS process runs its own processes
+      green. A '_' that can't, in any of them, waits in the semaphore list.
+      The scheduler looks at those waiting each time around, and when there
+      is nothing else to run, the OS process sleeps on the wake count in
+      the shared word, until a '^' on a segment it can't see changes it.
+      The live and sleeping processes are counted in the same word, so that
+      the one who makes them equal knows that nothing can wake up again.
+ */
+struct Forks
+ {
+   unsigned long word; /* Live processes, asleep ones, and the wake count */
+   int stop; /* Deadlocked: everyone leaves */
+ };
+
+struct Forks * Gforks = NULL; /* Shared by all of the forks */
+struct PCB * Gchild = NULL; /* The new process, in a child just forked */
+int Gforked = 0; /* I'm a child */
+
+ /*
+   The wake count: the half of the word that a futex can wait on.
+ */
+int * forkWake (void)
+ {
+   return (int *) &Gforks->word + (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+ }
+
+ /*
+   Wakes every process asleep, if there is one, and takes them off of the
+   count of those asleep. To stop, wakes them anyway.
+ */
+void wakeForks (int stop)
+ {
+   unsigned long w;
+
+   if (stop) __atomic_store_n(&Gforks->stop, 1, __ATOMIC_SEQ_CST);
+
+   w = __atomic_load_n(&Gforks->word, __ATOMIC_SEQ_CST);
+   do
+      if (!stop && (FASLEEP(w) == 0)) return;
+   while (!__atomic_compare_exchange_n(&Gforks->word, &w,
+             (w & ~(FWAKE - 1)) + FWAKE + FLIVE(w),
+             0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+   futex(forkWake(), FUTEX_WAKE, INT_MAX);
+   return;
+ }
+
+ /*
+   Schedules the threads whose semaphores are up. Returns how many.
+ */
+int pollSleepers (void)
+ {
+   struct TCB ** t, * w;
+   int woke;
+
+   woke = 0;
+   t = &sListHead;
+   while (*t != NULL)
+      if (cellReady((*t)->cmem, (*t)->dp, (*t)->want))
+       {
+         w = *t;
+         *t = w->next;
+         w->next = NULL;
+         schedule(w);
+         woke++;
+       }
+      else
+         t = &(*t)->next;
+   return woke;
+ }
+
+ /*
+   Sleeps until someone's '^', with nothing else to run. Counts me asleep
+   first, then looks one last time, so a '^' can't slip by.
+ */
+void forkSleep (void)
+ {
+   unsigned long w, n;
+
+   w = __atomic_load_n(&Gforks->word, __ATOMIC_SEQ_CST);
+   do
+      n = w + FSLEEP;
+   while (!__atomic_compare_exchange_n(&Gforks->word, &w, n,
+             0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+   if (pollSleepers())
+    {
+      w = n; /* Take my mark back, unless a wake did */
+      while (((w >> 32) == (n >> 32)) &&
+             !__atomic_compare_exchange_n(&Gforks->word, &w, w - FSLEEP,
+                 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+         ;
+      return;
+    }
+
+   if (FASLEEP(n) == FLIVE(n))
+    {
+      wakeForks(1);
+      return;
+    }
+
+   while (__atomic_load_n(forkWake(), __ATOMIC_SEQ_CST) == (int) (n >> 32))
+      futex(forkWake(), FUTEX_WAIT, n >> 32);
+   return;
+ }
+
+ /*
+   A process leaves the count, and maybe the others asleep for good.
+ */
+void forkLeave (void)
+ {
+   unsigned long n;
+
+   n = __atomic_sub_fetch(&Gforks->word, 1, __ATOMIC_SEQ_CST);
+   if ((FLIVE(n) != 0) && (FASLEEP(n) == FLIVE(n)) &&
+       !__atomic_load_n(&Gforks->stop, __ATOMIC_SEQ_CST))
+      wakeForks(1);
+   return;
+ }
+
+ /*
+   Forks the interpreter, as fork does.
+ */
+pid_t forkOff (void)
+ {
+   pid_t pid;
+
+   fflush(stdout); /* Or the child prints it again */
+   flushStreams();
+   __atomic_add_fetch(&Gforks->word, 1, __ATOMIC_SEQ_CST);
+
+   pid = fork();
+   if (pid < 0)
+      forkLeave();
+   else if (pid == 0)
+      Gforked = 1;
+   return pid;
+ }
+
+ /*
+   In a child just forked, everything but the new process is the parent's:
+   drops it all, but for the segment that the new process '~'s into. ME is
+   the thread that forked.
+ */
+void forkedAway (struct TCB * me)
+ {
+   struct PCB * p, * n;
+   struct TCB * t, * keep;
+
+   if (Gcurp != NULL) appendList(&pListHead, Gcurp);
+   Gcurp = NULL;
+
+   keep = NULL;
+   while ((t = removeFirst(&tListHead)) != NULL)
+      if (t->par == Gchild)
+         appendList(&keep, t);
+      else
+         free(t);
+   tListHead = keep;
+
+   if (sListHead != NULL) freeTlist(sListHead);
+   sListHead = NULL;
+
+   for (p = pListHead; p != NULL; p = n)
+    {
+      n = p->next;
+      if (p == Gchild) continue;
+      if (p->readyList != NULL) freeTlist(p->readyList);
+      if (p->dmem != Gchild->pmem) freeSeg(p->dmem);
+      free(p);
+    }
+   Gchild->next = NULL;
+   pListHead = Gchild;
+   Gchild = NULL;
+
+   free(me);
+   return;
+ }
+
+ /*
+   SHARDS
+      With -s, each shard is a worker process that runs some of the big
+      bang green, with a copy of the system memory, and its twin: the
+      copy as the interpreter last had it. The difference between the two
+      is what the shard has done since, and goes to the interpreter,
+      chunk by chunk, at each '^' and '_'. The interpreter adds it in, and
+      keeps the semaphores: it does the '_'s, and grants them. With each
+      grant go the chunks that changed since that shard last heard, and
+      the shard keeps its own changes on top of them.
+      Messages go in batches: a shard sends what it has every so many
+      slices, or when it needs an answer.
+ */
+struct Msg
+ {
+   int op;
+   long cell; /* Or the chunk */
+   long arg;
+   void * token; /* The thread that waits on a '_' */
+   size_t n; /* Bytes of the chunk that follow */
+ };
+
+struct Buf
+ {
+   char * b;
+   size_t len, cap;
+ };
+
+struct Shard
+ {
+   int fd;
+   pid_t pid;
+   int live;
+   int idle; /* Said so, and nothing granted since */
+   long granted;
+   unsigned long seen; /* The version of the system memory it has */
+   struct Buf in, out;
+ };
+
+struct Wait
+ {
+   struct Wait * next;
+   struct Shard * s;
+   long cell, want;
+   void * token;
+ };
+
+struct Shard * Gshard = NULL; /* The interpreter's */
+int Gshards = 0;
+unsigned long * Gstamp = NULL; /* The version that each chunk changed in */
+unsigned long Gversion = 0;
+struct Wait * Gwaits = NULL;
+
+int Gcoord = -1; /* A shard's socket to the interpreter */
+char * Gtwin = NULL;
+struct Buf Gsend, Grecv;
+struct TCB * Gremote = NULL; /* Waiting on the interpreter's '_' */
+long Ggot = 0; /* Grants */
+int Gticks = 0;
+
+ /*
+   Cell by cell, OUT = A - B, and OUT += A.
+ */
+void cellDelta (char * out, char * a, char * b, long n)
+ {
+   long i;
+
+   for (i = 0; i < n; i++)
+      if (Gwidth == 4)
+         ((unsigned int *) out)[i] =
+            ((unsigned int *) a)[i] - ((unsigned int *) b)[i];
+      else if (Gwidth == 2)
+         ((unsigned short *) out)[i] =
+            ((unsigned short *) a)[i] - ((unsigned short *) b)[i];
+      else
+         ((unsigned char *) out)[i] =
+            ((unsigned char *) a)[i] - ((unsigned char *) b)[i];
+   return;
+ }
+
+void cellAdd (char * out, char * a, long n)
+ {
+   long i;
+
+   for (i = 0; i < n; i++)
+      if (Gwidth == 4)
+         ((unsigned int *) out)[i] += ((unsigned int *) a)[i];
+      else if (Gwidth == 2)
+         ((unsigned short *) out)[i] += ((unsigned short *) a)[i];
+      else
+         ((unsigned char *) out)[i] += ((unsigned char *) a)[i];
+   return;
+ }
+
+ /*
+   The cells in chunk C.
+ */
+long chunkCells (long c)
+ {
+   return (Gcells - c * CHUNK < CHUNK) ? Gcells - c * CHUNK : CHUNK;
+ }
+
+void bufAdd (struct Buf * b, void * data, size_t n)
+ {
+   char * nb;
+
+   if (b->len + n > b->cap)
+    {
+      nb = realloc(b->b, 2 * (b->len + n));
+      if (nb == NULL)
+       {
+         fprintf(stderr, "err: no mem for messages\n");
+         exit(1);
+       }
+      b->b = nb;
+      b->cap = 2 * (b->len + n);
+    }
+   memcpy(b->b + b->len, data, n);
+   b->len += n;
+   return;
+ }
+
+void sendMsg (struct Buf * b, int op, long cell, long arg, void * token,
+              void * data, size_t n)
+ {
+   struct Msg m;
+
+   memset(&m, 0, sizeof(m));
+   m.op = op;
+   m.cell = cell;
+   m.arg = arg;
+   m.token = token;
+   m.n = n;
+   bufAdd(b, &m, sizeof(m));
+   if (n != 0) bufAdd(b, data, n);
+   return;
+ }
+
+ /*
+   Takes the first whole message from a buffer, into M. Returns its chunk,
+   if any, or NULL when there is no whole message yet.
+ */
+char * takeMsg (struct Buf * b, size_t * at, struct Msg * m)
+ {
+   if (b->len - *at < sizeof(struct Msg)) return NULL;
+   memcpy(m, b->b + *at, sizeof(struct Msg));
+   if (b->len - *at - sizeof(struct Msg) < m->n) return NULL;
+
+   *at += sizeof(struct Msg) + m->n;
+   return b->b + *at - m->n;
+ }
+
+ /*
+   Drops the messages taken, keeping the rest.
+ */
+void dropMsgs (struct Buf * b, size_t at)
+ {
+   memmove(b->b, b->b + at, b->len - at);
+   b->len -= at;
+   return;
+ }
+
+ /*
+   Reads what there is, waiting for it or not. Returns 0 at the end.
+ */
+int readMsgs (int fd, struct Buf * b, int wait)
+ {
+   char data [65536];
+   ssize_t n;
+
+   do
+      n = recv(fd, data, sizeof(data), wait ? 0 : MSG_DONTWAIT);
+   while ((n < 0) && (errno == EINTR));
+
+   if (n > 0) bufAdd(b, data, n);
+   return (n != 0);
+ }
+
+ /*
+   The shard's changes since the twin, chunk by chunk, into the batch.
+ */
+void shardDiff (void)
+ {
+   int delta [CHUNK];
+   long c, off, bytes;
+
+   for (c = 0; c * CHUNK < Gcells; c++)
+    {
+      off = c * CHUNK * Gwidth;
+      bytes = chunkCells(c) * Gwidth;
+      if (memcmp(Gsmem + off, Gtwin + off, bytes) == 0) continue;
+
+      cellDelta((char *) delta, Gsmem + off, Gtwin + off, chunkCells(c));
+      memcpy(Gtwin + off, Gsmem + off, bytes);
+      sendMsg(&Gsend, SDIFF, c, 0, NULL, delta, bytes);
+    }
+   return;
+ }
+
+ /*
+   Sends the batch to the interpreter.
+ */
+void shardSend (void)
+ {
+   size_t done;
+   ssize_t n;
+
+   for (done = 0; done < Gsend.len; done += n)
+    {
+      n = send(Gcoord, Gsend.b + done, Gsend.len - done, MSG_NOSIGNAL);
+      if (n < 0)
+       {
+         if (errno != EINTR) break; /* It's gone: so will I be */
+         n = 0;
+       }
+    }
+   Gsend.len = 0;
+   return;
+ }
+
+ /*
+   A '^' on the system memory, after it was done here.
+ */
+void shardUp (long dp)
+ {
+   shardDiff();
+   sendMsg(&Gsend, SWAKE, dp, 0, NULL, NULL, 0);
+   return;
+ }
+
+ /*
+   A '_' on the system memory: the interpreter does it. The thread waits
+   in Gremote, and goes on after the '_' when it's granted.
+ */
+void shardDown (struct TCB * me, long dp, long want)
+ {
+   shardDiff();
+   sendMsg(&Gsend, SDOWN, dp, want, me, NULL, 0);
+   shardSend();
+   return;
+ }
+
+ /*
+   Takes in what the interpreter sent. Returns the grants, or -1 to stop.
+ */
+int shardRecv (int wait)
+ {
+   int delta [CHUNK];
+   struct TCB ** t, * w;
+   struct Msg m;
+   char * data;
+   size_t at;
+   long off;
+   int grants;
+
+   if (!readMsgs(Gcoord, &Grecv, wait)) return -1;
+
+   grants = 0;
+   at = 0;
+   while ((data = takeMsg(&Grecv, &at, &m)) != NULL)
+      switch (m.op)
+       {
+         case SCHUNK: /* My own changes stay on top */
+            off = m.cell * CHUNK * Gwidth;
+            cellDelta((char *) delta, Gsmem + off, Gtwin + off,
+                      chunkCells(m.cell));
+            memcpy(Gtwin + off, data, m.n);
+            memcpy(Gsmem + off, data, m.n);
+            cellAdd(Gsmem + off, (char *) delta, chunkCells(m.cell));
+            break;
+
+         case SGRANT:
+            for (t = &Gremote; *t != m.token; t = &(*t)->next)
+               ;
+            w = *t;
+            *t = w->next;
+            w->next = NULL;
+            schedule(w);
+            Ggot++;
+            grants++;
+            break;
+
+         case SSTOP:
+            grants = -1;
+            break;
+       }
+   dropMsgs(&Grecv, at);
+   return grants;
+ }
+
+ /*
+   Between slices: sends the batch, and takes in grants, now and then.
+ */
+void shardPoll (void)
+ {
+   if ((++Gticks & 63) != 0) return;
+
+   if (Gsend.len != 0) shardSend();
+   if (Gremote != NULL) shardRecv(0);
+   return;
+ }
+
+ /*
+   The interpreter grants a '_' to a shard, with what it hasn't seen.
+ */
+void grant (struct Shard * s, void * token)
+ {
+   long c;
+
+   for (c = 0; c * CHUNK < Gcells; c++)
+      if (Gstamp[c] > s->seen)
+         sendMsg(&s->out, SCHUNK, c, 0, NULL,
+                 Gsmem + c * CHUNK * Gwidth, chunkCells(c) * Gwidth);
+   s->seen = Gversion;
+
+   sendMsg(&s->out, SGRANT, 0, 0, token, NULL, 0);
+   s->granted++;
+   s->idle = 0;
+   return;
+ }
+
+ /*
+   Grants what '_'s it can on a cell, first come, first served.
+ */
+void serveCell (long cell)
+ {
+   struct Wait ** w, * d;
+
+   w = &Gwaits;
+   while (*w != NULL)
+      if (((*w)->cell == cell) && cellReady(Gsmem, cell, (*w)->want))
+       {
+         d = *w;
+         *w = d->next;
+         if (Gwidth == 4) ((int *) Gsmem)[cell] -= d->want;
+         else if (Gwidth == 2) ((short *) Gsmem)[cell] -= d->want;
+         else Gsmem[cell] -= d->want;
+         Gstamp[cell / CHUNK] = ++Gversion;
+         grant(d->s, d->token);
+         free(d);
+       }
+      else
+         w = &(*w)->next;
+   return;
+ }
+
+ /*
+   The interpreter takes in what a shard sent.
+ */
+void serveShard (struct Shard * s)
+ {
+   struct Wait * d;
+   struct Msg m;
+   char * data;
+   size_t at;
+
+   at = 0;
+   while ((data = takeMsg(&s->in, &at, &m)) != NULL)
+      switch (m.op)
+       {
+         case SDIFF:
+            cellAdd(Gsmem + m.cell * CHUNK * Gwidth, data, chunkCells(m.cell));
+            Gstamp[m.cell] = ++Gversion;
+            break;
+
+         case SWAKE:
+            serveCell(m.cell);
+            break;
+
+         case SDOWN:
+            d = malloc(sizeof(struct Wait));
+            if (d == NULL)
+             {
+               fprintf(stderr, "err: no mem for a '_'\n");
+               break; /* It waits for good */
+             }
+            d->next = NULL;
+            d->s = s;
+            d->cell = m.cell;
+            d->want = m.arg;
+            d->token = m.token;
+            appendList(&Gwaits, d);
+            serveCell(m.cell);
+            break;
+
+         case SIDLE: /* Unless a grant passed it on the way */
+            if (m.arg == s->granted) s->idle = 1;
+            break;
+
+         case SDONE:
+            s->live = 0;
+            break;
+       }
+   dropMsgs(&s->in, at);
+   return;
+ }
+
+ /*
+   SCHEDULE LOGS
+      With -l, the green scheduler writes a log of what it can't decide
+      for itself: the length of each random slice, a byte each, and what
+      each ',' read, tagged. All else follows from those: which
+      thread runs next, and which sleeper a '^' wakes. With -L, the log is
+      read back instead, and the run goes exactly as it did, without any
+      input. The header has the options that change the schedule, which
+      the replay takes from it.
+ */
+FILE * Glog = NULL;
+int Greplay = 0;
+
+void logLost (void)
+ {
+   flushOut();
+   writerStop();
+   fprintf(stderr, "err: the run has left the log\n");
+   exit(1);
+ }
+
+ /*
+   Writes the log's header, or reads it back into the options. Returns 0
+   on success.
+ */
+int logStart (int * quanta)
+ {
+   char magic [sizeof(LOGMAGIC)];
+   long head [6];
+
+   if (!Greplay)
+    {
+      head[0] = *quanta;
+      head[1] = scheduler;
+      head[2] = Gunbound;
+      head[3] = Gcells;
+      head[4] = Gwidth;
+      head[5] = Gearly;
+      fputs(LOGMAGIC, Glog);
+      return fwrite(head, sizeof(head), 1, Glog) != 1;
+    }
+
+   if ((fread(magic, sizeof(LOGMAGIC) - 1, 1, Glog) != 1) ||
+       (memcmp(magic, LOGMAGIC, sizeof(LOGMAGIC) - 1) != 0) ||
+       (fread(head, sizeof(head), 1, Glog) != 1))
+      return 1;
+   *quanta = head[0];
+   scheduler = head[1];
+   Gunbound = head[2];
+   Gcells = head[3];
+   Gwidth = head[4];
+   Gearly = head[5];
+   return 0;
+ }
+
+ /*
+   Logs a random slice, or takes it from the log.
+ */
+int logSlice (int c)
+ {
+   if (!Greplay)
+      putc(c, Glog);
+   else if (((c = getc(Glog)) < 1) || (c > 128))
+      logLost();
+   return c;
+ }
+
+ /*
+   Logs what a ',' read, or takes it from the log.
+ */
+int logRead (int c)
+ {
+   if (!Greplay)
+    {
+      if (c == EOF)
+         putc(LEOF, Glog);
+      else
+       {
+         putc(LIN, Glog);
+         putc(c, Glog);
+       }
+      return c;
+    }
+
+   c = getc(Glog);
+   if (c == LEOF) return EOF;
+   if ((c != LIN) || ((c = getc(Glog)) == EOF)) logLost();
+   return c;
+ }
+
+ /*
+   INPUT
+      ',' reads through a buffer of the interpreter's own. A regular file
+      is mapped whole, and read right from the mapping. Anything else is
+      read() into a buffer, INSIZE at a time. A run of n ','s takes the
+      nth byte, and skips the rest without looking at them. The program
+      file is read the same way, by the compiler, and at its '!', what is
+      left of it becomes the input, instead of stdin. Forks and shards
+      share the input: a mapping through an offset in shared memory, and
+      anything else by reading just what they take, unbuffered.
+      With -A, a green ',' doesn't wait for input that isn't there yet:
+      it takes what there is, and the thread waits in rListHead, as a '_'
+      waits in sListHead, while the others run. The scheduler polls the
+      input for it, and, with nothing else to run, sleeps in poll() until
+      it comes. When input comes then changes the schedule, so it is off
+      by default, and never with a log.
+ */
+struct Input
+ {
+   pthread_mutex_t lock; /* For native threads */
+   int fd;
+   char * buf;
+   size_t at, len, cap; /* No buf: unbuffered */
+   size_t * shared; /* Where forks are in a mapping */
+   int mapped;
+   int eof;
+ };
+
+struct Input Gstdin;
+struct Input Gfile; /* The program, and the input after its '!' */
+struct Input Gafter; /* With -i, the input after the '!', found up front */
+struct Input * Gin = &Gstdin;
+int Gasync = 0; /* -A: green ','s wait in rListHead */
+
+ /*
+   Sets up input from FD, from where it is now.
+ */
+void openIn (struct Input * in, int fd)
+ {
+   struct stat st;
+   off_t at;
+   char * mem;
+
+   pthread_mutex_init(&in->lock, NULL);
+   in->fd = fd;
+   in->buf = NULL;
+   in->at = in->len = in->cap = 0;
+   in->shared = NULL;
+   in->mapped = 0;
+   in->eof = 0;
+
+   at = lseek(fd, 0, SEEK_CUR);
+   if ((at >= 0) && (fstat(fd, &st) == 0) && S_ISREG(st.st_mode) &&
+       (st.st_size > at))
+    {
+      mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mem != MAP_FAILED)
+       {
+         in->buf = mem;
+         in->at = at;
+         in->len = st.st_size;
+         in->mapped = 1;
+         return;
+       }
+    }
+
+   in->buf = malloc(INSIZE);
+   if (in->buf != NULL) in->cap = INSIZE;
+   return;
+ }
+
+ /*
+   Puts the file where the input was taken up to, if it can be.
+ */
+void seekIn (struct Input * in)
+ {
+   if (in->shared != NULL)
+      in->at = (*in->shared < in->len) ? *in->shared : in->len;
+   if (in->mapped)
+      lseek(in->fd, in->at, SEEK_SET);
+   else if (in->at < in->len)
+      lseek(in->fd, (off_t) in->at - (off_t) in->len, SEEK_CUR);
+   return;
+ }
+
+ /*
+   Shares the input, for forks and shards. A mapping is taken from
+   through a shared offset, and anything else is made unbuffered. Read
+   ahead from a pipe can't be given back, so that stays buffered.
+ */
+void shareIn (struct Input * in)
+ {
+   size_t * shared;
+
+   if (in->buf == NULL) return;
+   if (in->mapped)
+    {
+      shared = mmap(NULL, sizeof(size_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      if (shared != MAP_FAILED)
+       {
+         *shared = in->at;
+         in->shared = shared;
+         return;
+       }
+    }
+   if (!in->mapped && (in->at < in->len) &&
+       (lseek(in->fd, 0, SEEK_CUR) < 0)) return;
+
+   seekIn(in);
+   if (in->mapped)
+      munmap(in->buf, in->len);
+   else
+      free(in->buf);
+   in->buf = NULL;
+   in->at = in->len = in->cap = 0;
+   in->mapped = 0;
+   return;
+ }
+
+ /*
+   Done with the input: leaves the file where the input was taken up to.
+ */
+void closeIn (struct Input * in)
+ {
+   seekIn(in);
+   if (in->shared != NULL) munmap(in->shared, sizeof(size_t));
+   if (in->mapped)
+      munmap(in->buf, in->len);
+   else
+      free(in->buf);
+   in->buf = NULL;
+   in->shared = NULL;
+   in->mapped = 0;
+   pthread_mutex_destroy(&in->lock);
+   return;
+ }
+
+ /*
+   Reads up to N bytes into B. Returns how many, or 0 at the end.
+ */
+long readSome (struct Input * in, char * b, long n)
+ {
+   ssize_t r;
+
+   if (in->eof) return 0;
+   do
+      r = read(in->fd, b, n);
+   while ((r < 0) && (errno == EINTR));
+
+   if (r <= 0)
+    {
+      in->eof = 1; /* As stdio: once at the end, always */
+      return 0;
+    }
+   return r;
+ }
+
+ /*
+   Takes N bytes of unbuffered input, and returns the last of them, or EOF
+   if there were none.
+ */
+int readOnly (struct Input * in, long n)
+ {
+   char b [BUFSIZ];
+   long k;
+   int c;
+
+   c = EOF;
+   while ((n > 0) && ((k = readSome(in, b, (n < BUFSIZ) ? n : BUFSIZ)) > 0))
+    {
+      c = (unsigned char) b[k - 1];
+      n -= k;
+    }
+   return c;
+ }
+
+ /*
+   Takes N bytes of input, and returns the last of them, or EOF if there
+   were none.
+ */
+int takeIn (struct Input * in, long n)
+ {
+   size_t at;
+   long k;
+   int c;
+
+   if (in->buf == NULL) return readOnly(in, n);
+   if (in->shared != NULL)
+    {
+      at = __atomic_fetch_add(in->shared, n, __ATOMIC_SEQ_CST);
+      if (at >= in->len) return EOF;
+      at += n;
+      if (at > in->len) at = in->len;
+      return (unsigned char) in->buf[at - 1];
+    }
+
+   c = EOF;
+   while (n > 0)
+    {
+      if (in->at == in->len)
+       {
+         if (in->mapped)
+          {
+            in->eof = 1;
+            break;
+          }
+         in->len = readSome(in, in->buf, in->cap);
+         in->at = 0;
+         if (in->len == 0) break;
+       }
+      k = in->len - in->at;
+      if (k > n) k = n;
+      in->at += k;
+      n -= k;
+      c = (unsigned char) in->buf[in->at - 1];
+    }
+   return c;
+ }
+
+ /*
+   Points P at the buffered input that can be taken now, reading more if
+   there is none, and returns how much there is: 0 at the end. What is
+   used is then taken with takeIn(). Not for unbuffered or shared input.
+ */
+long peekIn (struct Input * in, char ** p)
+ {
+   if ((in->at == in->len) && !in->mapped)
+    {
+      in->len = readSome(in, in->buf, in->cap);
+      in->at = 0;
+    }
+   *p = in->buf + in->at;
+   return in->len - in->at;
+ }
+
+ /*
+   A ',' run N long. Returns the byte for the cell, or EOF to leave it.
+ */
+int readIn (long n)
+ {
+   int c;
+
+   if (Greplay) return logRead(EOF);
+
+   if (Gbuffered) pthread_mutex_lock(&Gin->lock);
+   c = takeIn(Gin, n);
+   if (Gbuffered) pthread_mutex_unlock(&Gin->lock);
+
+   if (Glog != NULL) logRead(c);
+   return c;
+ }
+
+ /*
+   Can input be taken without waiting? WAIT is poll()'s timeout.
+ */
+int inReady (struct Input * in, int wait)
+ {
+   struct pollfd p;
+   int r;
+
+   if ((in->at < in->len) || in->mapped || in->eof || (in->buf == NULL))
+      return 1;
+
+   p.fd = in->fd;
+   p.events = POLLIN;
+   do
+      r = poll(&p, 1, wait);
+   while ((r < 0) && (errno == EINTR));
+   return r != 0; /* An error, read() can tell */
+ }
+
+ /*
+   A green ',' run, N long, that takes only what input there is. Returns
+   how much of the run is done, and puts the last byte in C, or EOF.
+ */
+long readReady (long n, int * c)
+ {
+   long k, done;
+   int r;
+
+   if (Gin->mapped || (Gin->len - Gin->at >= (size_t) n))
+    {
+      *c = takeIn(Gin, n); /* It's all there */
+      return n;
+    }
+
+   *c = EOF;
+   done = 0;
+   while ((done < n) && inReady(Gin, 0))
+    {
+      k = Gin->len - Gin->at;
+      if (k == 0) k = 1; /* takeIn() reads more */
+      if (k > n - done) k = n - done;
+      r = takeIn(Gin, k);
+      if (r == EOF) return n; /* The rest would get EOF too */
+      *c = r;
+      done += k;
+    }
+   return done;
+ }
+
+ /*
+   Schedules the green threads waiting on input, once there is some.
+   WAIT is as for inReady().
+ */
+void pollReaders (int wait)
+ {
+   struct TCB * t;
+
+   if (!inReady(Gin, wait)) return;
+   while ((t = removeFirst((void **) &rListHead)) != NULL)
+      schedule(t);
+   return;
+ }
+
+/*
+   Creates a thread and schedules it.
+*/
+int createThread
+   (struct PCB * npar, void ** pr, void * npc, long ndp,
+    char * ncmem, void ** ns, int nsp)
+ {
+   struct TCB * c;
+   int i;
+
+   c = malloc(sizeof(struct TCB));
+
+   if (c != NULL)
+    {
+      __atomic_add_fetch(&npar->threads, 1, __ATOMIC_ACQ_REL);
+
+      c->next = NULL;
+
+      c->par = npar;
+
+      if (pr == NULL)
+         for (i = 0; i < NUMPROC; i++) c->procs[i] = NULL;
+      else
+         memcpy(c->procs, pr, sizeof(c->procs));
+
+      c->pc = npc;
+      c->dp = ndp;
+
+      c->cmem = ncmem;
+
+      if (ns != NULL) memcpy(c->stack, ns, sizeof(c->stack));
+
+      c->sp = nsp;
+
+      c->want = 0;
+      c->out = NULL;
+
+      if (greenHere())
+         schedule(c);
+      else if (startThread(c))
+       {
+         __atomic_sub_fetch(&npar->threads, 1, __ATOMIC_ACQ_REL);
+         free(c);
+         c = NULL;
+       }
+    }
+
+   return (c == NULL);
+ }
+
+/*
+   Creates a process, creates its thread,
+       and adds it to the process list only if both succeeded.
+       With no memory to copy, the process starts with a clear segment.
+
+      Returns 0 on success and 1 on failure.
+*/
+int createProcess
+   (char * copymem, struct PCB * npar, char * npmem, void ** nprocs,
+    void * npc, long ndp, void ** ns, int nsp)
+ {
+   struct PCB * c;
+   pid_t pid;
+
+   c = malloc(sizeof(struct PCB));
+
+   if (c != NULL)
+    {
+      c->next = NULL;
+
+      c->readyList = NULL;
+
+      c->parent = npar;
+      c->home = (npar == NULL) ? NULL : npar->home;
+      c->out = NULL;
+      if (Groute != NULL)
+         c->out = (npar == NULL) ? streamFor(Gbang++) : npar->out;
+
+      c->pmem = npmem;
+      c->dmem = allocSeg(copymem == NULL);
+
+      if (c->dmem != NULL)
+       {
+         c->threads = 0;
+         c->refs = 1;
+         c->forks = 0;
+
+         /* A native thread runs as soon as it's made: get it all ready. */
+         if (copymem != NULL) memcpy(c->dmem, copymem, Gdbytes);
+
+         if ((Gnative == FORKS) && (npar != NULL))
+          {
+            pid = forkOff();
+            if (pid != 0) /* The child has the new segment: I don't */
+             {
+               freeSeg(c->dmem);
+               free(c);
+               if (pid < 0) return 1;
+
+               npar->forks++;
+               return 0;
+             }
+            c->parent = npar = NULL; /* My parent is in another process */
+            Gchild = c;
+          }
+
+         if (npar != NULL) __atomic_add_fetch(&npar->refs, 1, __ATOMIC_ACQ_REL);
+
+         if (!createThread(c, nprocs, npc, ndp, c->dmem, ns, nsp))
+          {
+            if (greenHere()) appendList(&pListHead, c);
+          }
+         else
+          {
+            if (c == Gchild) /* A child without a thread is no child */
+             {
+               forkLeave();
+               exit(1);
+             }
+            if (npar != NULL) releaseProcess(npar);
+            freeSeg(c->dmem);
+            free(c);
+
+            c = NULL;
+          }
+       }
+      else
+       {
+         free(c);
+
+         c = NULL;
+       }
+    }
+
+   return (c == NULL);
+ }
+
+/*
+   Searches the list of threads waiting on semaphores to see if the increment
+   was on their semaphore. Yes, this is hella inefficient.
+*/
+void checkSemaphores (char * mem, long ptr)
+ {
+   struct TCB * this, * last;
+
+   last = NULL;
+   this = sListHead;
+   while (this != NULL)
+    {
+      if ((this->dp == ptr) && (this->cmem == mem))
+       {
+         if (last == NULL) sListHead = sListHead->next;
+         else last->next = this->next;
+         this->next = NULL;
+         schedule(this);
+         return;
+       }
+      last = this;
+      this = this->next;
+    }
+   return;
+ }
+
+#define QPASTE(a, b) a ## b
+#define QJOIN(a, b) QPASTE(a, b)
+
+#define QPAR 0
+
+#define QNAME doQuanta8K
+#define QCELL char
+#define QMASK DMASK
+#include "quanta.h"
+
+#define QNAME doQuanta8
+#define QCELL char
+#define QMASK Gdmask
+#include "quanta.h"
+
+#define QNAME doQuanta16
+#define QCELL short
+#define QMASK Gdmask
+#include "quanta.h"
+
+#define QNAME doQuanta32
+#define QCELL int
+#define QMASK Gdmask
+#include "quanta.h"
+
+#undef QPAR
+
+#define QPAR 1
+
+#define QNAME doQuanta8KN
+#define QCELL char
+#define QMASK DMASK
+#include "quanta.h"
+
+#define QNAME doQuanta8N
+#define QCELL char
+#define QMASK Gdmask
+#include "quanta.h"
+
+#define QNAME doQuanta16N
+#define QCELL short
+#define QMASK Gdmask
+#include "quanta.h"
+
+#define QNAME doQuanta32N
+#define QCELL int
+#define QMASK Gdmask
+#include "quanta.h"
+
+#undef QPAR
+
+ /* Instruction loops by [native][tape] */
+int (* Gquanta [2][4]) (struct TCB * me, int quanta) =
+ {
+    { doQuanta8K, doQuanta8, doQuanta16, doQuanta32 },
+    { doQuanta8KN, doQuanta8N, doQuanta16N, doQuanta32N }
+ };
+
+/*
+   Execute the current state.
+*/
+void execute (int quanta)
+ {
+   struct TCB * curt;
+   int c;
+
+   curt = getNextThread();
+
+   while (curt != NULL)
+    {
+      if (quanta < 0)
+       {
+         c = (rand() & 127) + 1;
+         if (Glog != NULL) c = logSlice(c);
+       }
+      else
+         c = quanta;
+
+      c = doQuanta(curt, c);
+
+      switch (c)
+       {
+         case 0: // Normal time-out or yielded processor
+            schedule(curt);
+            break;
+
+         case 1: // Thread died
+            if (Gbuffered) outDone(curt);
+            curt->par->threads--;
+            if (curt->par->threads == 0)
+               makeDead(curt->par);
+            free(curt);
+            break;
+
+         case 2: // Thread blocked: put to sleep
+            if ((Gnative == FAMILIES) && (curt->cmem == Gsmem))
+               parkHome(curt); /* Another family may wake it */
+            else if ((Gnative == SHARDS) && (curt->cmem == Gsmem))
+             {
+               curt->next = Gremote; /* The interpreter grants it */
+               Gremote = curt;
+             }
+            else
+               appendList(&sListHead, curt);
+            break;
+
+         case 3: // Forked: I'm the child now
+            forkedAway(curt);
+            break;
+
+         case 4: // Waiting on input
+            appendList(&rListHead, curt);
+            break;
+       }
+
+      /* Another process's '^' doesn't look for my sleepers: I look. */
+      if ((Gnative == FORKS) && (sListHead != NULL)) pollSleepers();
+      else if (Gnative == SHARDS) shardPoll();
+
+      if (rListHead != NULL) pollReaders(0);
+
+      if (Ghome != NULL) takeHome(Ghome); /* Woken by another family */
+
+      compileNext(); /* With -i, another process of the big bang */
+      curt = getNextThread();
+      while ((curt == NULL) && compileNext())
+         curt = getNextThread();
+      while ((curt == NULL) && (rListHead != NULL))
+       {
+         pollReaders(-1); /* Nothing else to do */
+         curt = getNextThread();
+       }
+    }
+
+   return;
+ }
+
+ /*
+   Frees whatever is left in the scheduler's lists.
+ */
+void freeLists (void)
+ {
+   if (pListHead != NULL) freePlist(pListHead);
+   pListHead = NULL;
+
+   if (tListHead != NULL) freeTlist(tListHead);
+   tListHead = NULL;
+
+   if (sListHead != NULL) freeTlist(sListHead);
+   sListHead = NULL;
+
+   if (rListHead != NULL) freeTlist(rListHead);
+   rListHead = NULL;
+   return;
+ }
+
+ /*
+   Runs a family, until nothing in it can run again.
+ */
+void * familyThread (void * arg)
+ {
+   struct Family * f;
+   struct TCB * t, * n;
+
+   f = arg;
+   Ghome = f;
+   pListHead = f->big;
+   while ((t = removeFirst((void **) &f->inbox)) != NULL)
+      schedule(t);
+   while (1)
+    {
+      if (!__atomic_load_n(&Gstop, __ATOMIC_SEQ_CST)) execute(Gslice);
+      if (f->out == 0) break;
+
+      for (t = waitHome(f); t != NULL; t = n)
+       {
+         n = t->next;
+         t->next = NULL;
+         f->out--;
+         if (Gstop)
+            appendList(&sListHead, t); /* Deadlocked: just free it */
+         else
+            schedule(t);
+       }
+    }
+
+   freeLists();
+   Ghome = NULL;
+   runCount(-1);
+   return NULL;
+ }
+
+/*
+   Runs each process of the big bang, and its family, on an OS thread. I
+   run the last of them, and any that there were no threads for.
+*/
+void executeFamilies (int quanta)
+ {
+   struct PCB * p;
+   struct TCB * t;
+   int i, j, n;
+
+   n = 0;
+   for (p = pListHead; p != NULL; p = p->next) n++;
+
+   Gfamily = calloc(n + 1, sizeof(struct Family));
+   if ((Gfamily == NULL) || (n == 0))
+    {
+      if (n != 0) fprintf(stderr, "err: no mem for families\n");
+      free(Gfamily);
+      Gfamily = NULL;
+      Grun = 0;
+      return;
+    }
+
+   for (i = 0; i < n; i++)
+    {
+      pthread_mutex_init(&Gfamily[i].lock, NULL);
+      pthread_cond_init(&Gfamily[i].wake, NULL);
+      p = removeFirst((void **) &pListHead);
+      p->home = Gfamily + i;
+      Gfamily[i].big = p;
+    }
+
+   /* The thread scheduler has them all in my list: hand them out. */
+   while ((t = removeFirst((void **) &tListHead)) != NULL)
+      appendList((void **) &t->par->home->inbox, t);
+
+   Gslice = quanta;
+   for (i = 0; i < n - 1; i++)
+    {
+      __atomic_add_fetch(&Grun, 1, __ATOMIC_SEQ_CST);
+      if (pthread_create(&Gfamily[i].id, NULL, familyThread, Gfamily + i))
+       {
+         __atomic_sub_fetch(&Grun, 1, __ATOMIC_SEQ_CST);
+         break;
+       }
+    }
+
+   for (j = i + 1; j < n; j++)
+    {
+      Gfamily[j].big->home = Gfamily + i;
+      appendList((void **) &Gfamily[i].big, Gfamily[j].big);
+      appendList((void **) &Gfamily[i].inbox, Gfamily[j].inbox);
+    }
+   familyThread(Gfamily + i); /* Mine are counted in Grun already */
+
+   for (j = 0; j < i; j++)
+      pthread_join(Gfamily[j].id, NULL);
+
+   for (j = 0; j < n; j++)
+    {
+      pthread_mutex_destroy(&Gfamily[j].lock);
+      pthread_cond_destroy(&Gfamily[j].wake);
+    }
+   free(Gfamily);
+   Gfamily = NULL;
+
+   outEnd();
+   Gstop = 0;
+   return;
+ }
+
+/*
+   Runs the processes, forking as they fork. Each child comes back here
+   from its fork, and leaves once its own children are done.
+*/
+void executeForks (int quanta)
+ {
+   Gforks = mmap(NULL, sizeof(struct Forks), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (Gforks == MAP_FAILED)
+    {
+      fprintf(stderr, "err: no mem for forks\n");
+      Gforks = NULL;
+      return;
+    }
+   Gforks->word = 1;
+   Gforks->stop = 0;
+
+   while (1)
+    {
+      execute(quanta);
+      if ((sListHead == NULL) || __atomic_load_n(&Gforks->stop, __ATOMIC_SEQ_CST))
+         break;
+      forkSleep();
+    }
+
+   forkLeave();
+   while ((wait(NULL) > 0) || (errno == EINTR))
+      ;
+   if (Gforked)
+    {
+      freeLists();
+      flushStreams();
+      exit(0);
+    }
+
+   munmap(Gforks, sizeof(struct Forks));
+   Gforks = NULL;
+   return;
+ }
+
+ /*
+   A shard keeps its share of the big bang: every Nth process, from the
+   Kth. Then it runs them, and leaves.
+ */
+void shardWorker (int k, int n, int quanta)
+ {
+   struct PCB * p, * keep;
+   struct TCB * t, * mine;
+   int i, r;
+
+   keep = NULL;
+   for (i = 0; (p = removeFirst((void **) &pListHead)) != NULL; i++)
+      if (i % n == k)
+         appendList(&keep, p);
+      else
+         appendList(&Gcurp, p); /* For now */
+
+   mine = NULL;
+   while ((t = removeFirst((void **) &tListHead)) != NULL)
+    {
+      for (p = keep; (p != NULL) && (p != t->par); p = p->next)
+         ;
+      if (p != NULL)
+         appendList(&mine, t);
+      else
+         free(t);
+    }
+   pListHead = Gcurp; /* The others' */
+   Gcurp = NULL;
+   freeLists();
+   pListHead = keep;
+   tListHead = mine;
+
+   Gtwin = malloc(Gdbytes);
+   if (Gtwin == NULL)
+    {
+      fprintf(stderr, "err: no mem for a shard\n");
+      exit(1);
+    }
+   memcpy(Gtwin, Gsmem, Gdbytes);
+
+   r = 0;
+   while (1)
+    {
+      execute(quanta);
+      if (Gremote == NULL) break;
+
+      shardDiff();
+      sendMsg(&Gsend, SIDLE, 0, Ggot, NULL, NULL, 0);
+      shardSend();
+      while ((r = shardRecv(1)) == 0)
+         ;
+      if (r < 0) break;
+    }
+
+   if (r >= 0) /* Not stopped */
+    {
+      shardDiff();
+      sendMsg(&Gsend, SDONE, 0, 0, NULL, NULL, 0);
+      shardSend();
+    }
+
+   freeLists();
+   if (Gremote != NULL) freeTlist(Gremote);
+   free(Gtwin);
+   free(Gsend.b);
+   free(Grecv.b);
+   flushStreams();
+   exit(0);
+ }
+
+ /*
+   The interpreter serves the shards the system memory, until they're all
+   gone. When all that are left are idle, nothing can be granted again.
+ */
+void shardServer (void)
+ {
+   struct pollfd * fds;
+   struct Wait * d;
+   ssize_t n;
+   int i, live, idle;
+
+   fds = calloc(Gshards, sizeof(struct pollfd));
+   if (fds == NULL)
+    {
+      fprintf(stderr, "err: no mem for shards\n");
+      return;
+    }
+
+   do
+    {
+      for (i = 0; i < Gshards; i++)
+       {
+         fds[i].fd = Gshard[i].live ? Gshard[i].fd : -1;
+         fds[i].events = POLLIN | (Gshard[i].out.len ? POLLOUT : 0);
+       }
+      if ((poll(fds, Gshards, -1) < 0) && (errno != EINTR)) break;
+
+      for (i = 0; i < Gshards; i++)
+       {
+         if (fds[i].revents & POLLOUT)
+          {
+            n = send(Gshard[i].fd, Gshard[i].out.b, Gshard[i].out.len,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) dropMsgs(&Gshard[i].out, n);
+          }
+         if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+          {
+            if (!readMsgs(Gshard[i].fd, &Gshard[i].in, 0))
+               Gshard[i].live = 0;
+            serveShard(Gshard + i);
+          }
+       }
+
+      live = idle = 0; /* Once all is served: it can grant to any */
+      for (i = 0; i < Gshards; i++)
+       {
+         live += Gshard[i].live;
+         idle += Gshard[i].live && Gshard[i].idle;
+       }
+
+      if ((live != 0) && (idle == live)) /* Deadlocked */
+         for (i = 0; i < Gshards; i++)
+            if (Gshard[i].live)
+             {
+               sendMsg(&Gshard[i].out, SSTOP, 0, 0, NULL, NULL, 0);
+               Gshard[i].idle = 0;
+             }
+    }
+   while (live != 0);
+
+   while ((d = removeFirst((void **) &Gwaits)) != NULL) free(d);
+   free(fds);
+   return;
+ }
+
+/*
+   Deals the big bang out to the shards, and serves them.
+*/
+void executeShards (int quanta)
+ {
+   struct PCB * p;
+   int i, j, n, sv [2];
+
+   n = 0;
+   for (p = pListHead; p != NULL; p = p->next) n++;
+
+   if (Gshards == 0) Gshards = Gcores;
+   if (Gshards > n) Gshards = n;
+   if (Gshards < 1) return;
+
+   Gshard = calloc(Gshards, sizeof(struct Shard));
+   Gstamp = calloc(Gcells / CHUNK + 1, sizeof(unsigned long));
+   if ((Gshard == NULL) || (Gstamp == NULL))
+    {
+      fprintf(stderr, "err: no mem for shards\n");
+      free(Gshard);
+      free(Gstamp);
+      return;
+    }
+   Gversion = 0;
+
+   fflush(stdout); /* Or the shards print it again */
+   flushStreams();
+   for (i = 0; i < Gshards; i++)
+    {
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0)
+       {
+         Gshard[i].pid = fork();
+         if (Gshard[i].pid == 0)
+          {
+            for (j = 0; j < i; j++) close(Gshard[j].fd);
+            close(sv[0]);
+            Gcoord = sv[1];
+            shardWorker(i, Gshards, quanta);
+          }
+         close(sv[1]);
+         if (Gshard[i].pid < 0) close(sv[0]);
+       }
+      else
+         Gshard[i].pid = -1;
+
+      if (Gshard[i].pid < 0)
+       {
+         fprintf(stderr, "err: no shard %d: its processes won't run\n", i);
+         continue;
+       }
+      Gshard[i].fd = sv[0];
+      Gshard[i].live = 1;
+    }
+
+   shardServer();
+
+   for (i = 0; i < Gshards; i++)
+      if (Gshard[i].pid > 0)
+       {
+         close(Gshard[i].fd);
+         waitpid(Gshard[i].pid, NULL, 0);
+         free(Gshard[i].in.b);
+         free(Gshard[i].out.b);
+       }
+   free(Gshard);
+   Gshard = NULL;
+   free(Gstamp);
+   Gstamp = NULL;
+   return;
+ }
+
+ /*
+   An ungetc wrapper.
+ */
+void unGetNext (int c, struct Input * fin)
+ {
+   if (c != EOF) fin->at--; /* Just taken, so still in the buffer */
+   return;
+ }
+
+ /*
+   A getc hack for this program. It filters out the crap.
+ */
+int getNext (struct Input * fin)
+ {
+   int c, v;
+
+   v = BAD;
+   while (v == BAD)
+    {
+      if (fin->at < fin->len)
+         c = (unsigned char) fin->buf[fin->at++];
+      else
+         c = takeIn(fin, 1);
+      switch (c)
+       {
+         case EOF:
+         case '+': case '-': case '<': case '>': case '.': case ',':
+         case '[': case ']': case '{': case '}': case '(': case '|':
+         case ')': case ':': case ';': case '$': case '`': case '\'':
+         case '^': case '_': case '%': case '&': case '#': case '~':
+         case '*': case '@': case '=': case '!':
+         case '0': case '1': case '2': case '3': case '4': case '5':
+         case '6': case '7': case '8': case '9':
+         case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
+         case 'G': case 'H': case 'I': case 'J': case 'K': case 'L':
+         case 'M': case 'N': case 'O': case 'P': case 'Q': case 'R':
+         case 'S': case 'T': case 'U': case 'V': case 'W': case 'X':
+         case 'Y': case 'Z':
+         case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
+         case 'g': case 'h': case 'i': case 'j': case 'k': case 'l':
+         case 'm': case 'n': case 'o': case 'p': case 'q': case 'r':
+         case 's': case 't': case 'u': case 'v': case 'w': case 'x':
+         case 'y': case 'z':
+            v = GOOD;
+       }
+    }
+
+   return c;
+ }
+
+ /*
+   backFills break and continue statements.
+   Chaining the breaks recursively seemed like a good idea, but didn't
+   actually work with breaks interleaved with if statements.
+ */
+void backFill (long * mimem, long start, long end)
+ {
+   while (start < end)
+    {
+      if (mimem[start] == '\'')
+         mimem[start] = '|' | (end - start - 1) << SHIFT;
+      else if (mimem[start] == '`')
+         mimem[start] = '|' | (end - start - 2) << SHIFT;
+      start++;
+    }
+ }
+
+ /*
+   Is the body of a loop, from START to END, private? It is if all that it
+   does is move, do arithmetic and branch: no '~', so it stays on the one
+   segment, no '&' or '%', so nobody else gets into it, and no '^', '_',
+   I/O or calls, so nobody can see or wait on what it does until it ends.
+   If the segment is private when such a loop starts, it is private until
+   the loop ends.
+ */
+int privateLoop (long * mimem, long start, long end)
+ {
+   while (start < end)
+    {
+      switch (mimem[start++] & IMASK)
+       {
+         case '+': case '-': case '<': case '>': case '"': case '=':
+         case '[': case PLOOP: case ']': case '{': case '}':
+         case '(': case '|': case ')':
+         case CLEARS: case MOVES: case SHIFTR: case SHIFTL:
+            break;
+
+         default:
+            return 0;
+       }
+    }
+   return 1;
+ }
+
+ /*
+   Is the body of a loop, the four ops at BODY, that of [->+<]: take one
+   from the cell, add one to another so far off, and come back? Returns
+   how far off, around the tape, or 0 if it isn't.
+ */
+long moveLoop (long * body)
+ {
+   long * m;
+   long k;
+
+   if (body[0] == ('-' | (1 << SHIFT)))
+      m = body + 1;
+   else if (body[3] == ('-' | (1 << SHIFT)))
+      m = body;
+   else
+      return 0;
+
+   k = m[0] >> SHIFT;
+   if ((m[1] != ('+' | (1 << SHIFT))) || ((m[2] >> SHIFT) != k) ||
+       !((((m[0] & IMASK) == '>') && ((m[2] & IMASK) == '<')) ||
+         (((m[0] & IMASK) == '<') && ((m[2] & IMASK) == '>'))))
+      return 0;
+
+   k %= Gcells;
+   if ((m[0] & IMASK) == '<') k = (Gcells - k) % Gcells;
+   return k;
+ }
+
+ /*
+   A MOVES one cell over has just been compiled, before *CP. If it ends a
+   run of them, one cell apart, going the other way, they become a SHIFTR
+   or a SHIFTL. *CP is moved back over what is gone.
+ */
+void shiftRun (long * mimem, long * cp)
+ {
+   long op, back, i;
+
+   i = *cp - 1;
+   if (mimem[i] == (MOVES | (1 << SHIFT)))
+    {
+      op = SHIFTR;
+      back = '<';
+    }
+   else if (mimem[i] == (MOVES | ((Gcells - 1) << SHIFT)))
+    {
+      op = SHIFTL;
+      back = '>';
+    }
+   else
+      return;
+
+   if ((i < 2) || (mimem[i - 1] != (back | (1 << SHIFT))))
+      return;
+   if (mimem[i - 2] == mimem[i])
+      mimem[i - 2] = op | (2 << SHIFT);
+   else if ((mimem[i - 2] & IMASK) == op)
+      mimem[i - 2] += 1 << SHIFT;
+   else
+      return;
+   *cp -= 2;
+   return;
+ }
+
+ /*
+   A '>' has just been compiled, before *CP. If it ends a run of [-]>,
+   they become a CLEARS. *CP is moved back over what is gone.
+ */
+void clearRun (long * mimem, long * cp)
+ {
+   long i;
+
+   i = *cp - 1;
+   if ((mimem[i] != ('>' | (1 << SHIFT))) || (i < 3) ||
+       (mimem[i - 1] != '"'))
+      return;
+   if ((mimem[i - 2] & IMASK) == CLEARS)
+      mimem[i - 2] += 1 << SHIFT;
+   else if ((mimem[i - 2] == mimem[i]) && (mimem[i - 3] == '"'))
+    {
+      mimem[i - 3] = CLEARS | (2 << SHIFT);
+      *cp -= 1;
+    }
+   else
+      return;
+   *cp -= 2;
+   return;
+ }
+
+ /*
+   With -d, each '@' segment, and each procedure's body, is compiled the
+   first time it runs. Until then it is a LAZY op, whose operand is its
+   place in this table, which has room for all of them from the start.
+ */
+struct Lazy
+ {
+   size_t at; /* Where it starts in the program */
+   int body; /* A procedure's body, rather than a segment */
+   void * code; /* NULL until compiled */
+ };
+
+struct Lazy * Glazy = NULL;
+long Gnlazy;
+pthread_mutex_t GlazyLock = PTHREAD_MUTEX_INITIALIZER;
+
+ /*
+   The matcher, without the compiler: checks the code in BUF, from AT to
+   LEN, just as recCompile would, but only looks at the brackets. OPEN is
+   what it is in, '@' at the top, and LOOP is whether a break or continue
+   has a loop to go to. Returns where it ends, just past its closer (or
+   the '@' or '!' or end of the segment), or BAD. *PROCS counts bodies.
+ */
+long skimCode (char * buf, long at, long len, int open, int loop,
+               long * procs)
+ {
+   long np;
+
+   while (at < len)
+    {
+      switch (buf[at++])
+       {
+         case '[':
+         case '{':
+            np = skimCode(buf, at, len, buf[at - 1], 1, procs);
+            if (np == BAD) return BAD;
+            at = np;
+            break;
+
+         case '(':
+            np = skimCode(buf, at, len, '(', loop, procs);
+            if (np == BAD) return BAD;
+            at = np;
+            break;
+
+         case ':':
+            (*procs)++;
+            np = skimCode(buf, at, len, ':', 0, procs);
+            if (np == BAD) return BAD;
+            at = np;
+            break;
+
+         case ']':
+            return (open == '[') ? at : BAD;
+
+         case '}':
+            return (open == '{') ? at : BAD;
+
+         case '|':
+            if (open != '(') return BAD;
+            open = '|';
+            break;
+
+         case ')':
+            return ((open == '(') || (open == '|')) ? at : BAD;
+
+         case ';':
+            return (open == ':') ? at : BAD;
+
+         case '`':
+         case '\'':
+            if (!loop) return BAD;
+            break;
 
          case '@':
-            return 1;
+         case '!':
+            return (open == '@') ? at : BAD;
+       }
+    }
+   return (open == '@') ? at : BAD;
+ }
+
+ /*
+   With -d, the ':' at CP - 1 gets its name, then a LAZY op for the rest
+   of its body, and the ';', where recCompile would do the whole body.
+   Without a name, nothing can ever call the body, so there is just the
+   ';'. Returns where compiling goes on, or BAD.
+ */
+long lazyBody (long * mimem, struct Input * fin, long cp)
+ {
+   long op, np, procs;
+   int c;
+
+   op = cp - 1;
+   procs = 0;
+   c = getNext(fin);
+   if (procNum(c) != NOPROC)
+      mimem[cp++] = c;
+   else
+      unGetNext(c, fin);
+
+   np = skimCode(fin->buf, fin->at, fin->len, ':', 0, &procs);
+   if (np == BAD) return BAD;
+
+   if (cp - op == 2)
+    {
+      Glazy[Gnlazy].at = fin->at;
+      Glazy[Gnlazy].body = 1;
+      Glazy[Gnlazy].code = NULL;
+      mimem[cp++] = LAZY | (Gnlazy++ << SHIFT);
+    }
+   fin->at = np;
+   mimem[cp++] = ';';
+   mimem[op] |= (cp - op - 1) << SHIFT;
+   return cp;
+ }
+
+ /*
+   The recursive compiler, built from the recursive matcher!
+ */
+long recCompile (long * mimem, struct Input * fin, long cp, long ll, int * pi)
+ {
+   long op, np, rl, to;
+   int cc, bf;
+
+   bf = 0;
+   op = cp - 1;
+   while (1)
+    {
+      cc = getNext(fin);
+
+      if (strchr("+-><^_,.~=", cc) != NULL)
+       {
+         rl = 1;
+         np = getNext(fin);
+         while (np == cc)
+          {
+            rl++;
+            np = getNext(fin);
+          }
+         unGetNext(np, fin);
+       }
+      else
+         rl = 0;
+
+      mimem[cp++] = cc | (rl << SHIFT);
+      switch (cc)
+       {
+         case '~':
+            if ((rl & 1) == 0)
+               cp--;
+            break;
+
+         case '$':
+            mimem[cp - 1] = ';';
+            break;
+
+         case '>':
+            clearRun(mimem, &cp);
+            break;
+
+         case '[':
+            np = recCompile(mimem, fin, cp, cp, NULL);
+            if (np == BAD) return BAD;
+            mimem[cp - 1] |= (np - cp) << SHIFT;
+            mimem[np - 1] |= (np - cp) << SHIFT;
+            if ((cp == 1) || ((mimem[cp - 2] & IMASK) == ']') ||
+                (mimem[cp - 2] == '"') || (mimem[cp - 2] == '@') ||
+                ((mimem[cp - 2] & IMASK) == MOVES) ||
+                ((mimem[cp - 2] & IMASK) == SHIFTR) ||
+                ((mimem[cp - 2] & IMASK) == SHIFTL))
+               cp--;
+            else if (((cp + 2) == np) && (mimem[cp] == ('-' | (1 << SHIFT))))
+               mimem[cp - 1] = '"';
+            else if (((cp + 5) == np) && ((to = moveLoop(mimem + cp)) != 0))
+             {
+               mimem[cp - 1] = MOVES | (to << SHIFT);
+               shiftRun(mimem, &cp);
+             }
+            else if (((cp + 3) == np) && (mimem[cp] == ('.' | (1 << SHIFT))) &&
+                     ((mimem[cp + 1] & IMASK) == '>') &&
+                     ((mimem[cp + 1] >> SHIFT) <= MAXARG))
+             {
+               mimem[cp] = PRINTS | (1 << SHIFT);
+               cp = np;
+             }
+            else if (((cp + 3) == np) && ((mimem[cp] & IMASK) == '>') &&
+                     ((mimem[cp] >> SHIFT) <= MAXARG) &&
+                     (mimem[cp + 1] == (',' | (1 << SHIFT))))
+             {
+               mimem[cp] = READS | (mimem[cp] & ~IMASK);
+               cp = np;
+             }
+            else
+             {
+               if (privateLoop(mimem, cp, np - 1))
+                  mimem[cp - 1] = PLOOP | (mimem[cp - 1] & ~IMASK);
+               cp = np;
+             }
+            break;
 
-         case ')':
+         case '{':
+            np = recCompile(mimem, fin, cp, cp, NULL);
+            if (np == BAD) return BAD;
+            mimem[cp - 1] |= (np - cp) << SHIFT;
+            mimem[np - 1] |= (np - cp) << SHIFT;
+            if ((cp != 1) && ((mimem[cp - 2] & IMASK) == '}'))
+               cp--;
+            else
+               cp = np;
             break;
 
-         case '=':
-            cost = curc >> SHIFT;
+         case '(':
+            np = recCompile(mimem, fin, cp, ll, &bf);
+            if (np == BAD) return BAD;
+            cp = np;
             break;
 
-         case '"':
-            me->cmem[me->dp] = 0;
+         case ':':
+            if (Glazy != NULL)
+               np = lazyBody(mimem, fin, cp);
+            else
+               np = recCompile(mimem, fin, cp, BAD, NULL);
+            if (np == BAD) return BAD;
+            cp = np;
             break;
 
-         case '~':
-            if (me->cmem == me->par->pmem)
-               me->cmem = me->par->dmem;
-            else if (me->par->pmem != NULL) /* If I don't want smem */
-               me->cmem = me->par->pmem;
+         case ']':
+            if (mimem[op] != '[') return BAD;
+            if (bf) backFill(mimem, op + 1, cp);
+            return cp;
+
+         case '}':
+            if (mimem[op] != '{') return BAD;
+            if (bf) backFill(mimem, op + 1, cp);
+            return cp;
+
+         case '|':
+            if (mimem[op] != '(') return BAD;
+            mimem[op] |= (cp - op - 1) << SHIFT;
+            op = cp - 1;
             break;
 
+         case ')':
+            if ((mimem[op] != '(') && (mimem[op] != '|')) return BAD;
+            cp--;
+            mimem[op] |= (cp - op - 1) << SHIFT;
+            if (bf) *pi |= bf;
+            return cp;
+
          case ';':
-            if (me->sp == STACKSIZE)
-               return 1;
-            else
-               me->pc = me->stack[me->sp++];
+            if (mimem[op] != ':') return BAD;
+            mimem[op] |= (cp - op - 1) << SHIFT;
+            return cp;
+
+         case '`':
+            if (ll == BAD) return BAD;
+            bf |= 1;
             break;
 
-         case '#':
-            cost = 0;
-            printf("\npc: %d\ndp: %d\nticks: %d\ndata:",
-               me->pc - Gimem, me->dp, quanta);
-            for (curc = 0; curc < 16; curc++)
-               printf(" %02x", me->cmem[(me->dp + curc) & DMASK]);
-            putchar('\n');
+         case '\'':
+            if (ll == BAD) return BAD;
+            bf |= 1;
             break;
 
-         default:
-            curc = procNum(curc);
-            if ((curc != NOPROC) && (me->procs[curc] != NULL))
+         case '@':
+         case '!':
+         case EOF:
+            if ((op == -1) || (mimem[op] == '@'))
              {
-               if ((*me->pc == ';') || (*me->pc == '$'))
-                  me->pc = me->procs[curc];
-               else if (me->sp == 0)
-                  fprintf(stderr, "err: no mem for call\n");
-               else
-                {
-                  me->stack[--me->sp] = me->pc;
-                  me->pc = me->procs[curc];
-                }
+               if (cc == EOF) mimem[cp - 1] = '@';
+               return cp;
              }
             else
-               cost = 0;
-            break;
+               return BAD;
        }
+    }
+ }
+
+ /*
+   On a ring tape, the data pointer need only wrap at the end of a block of
+   moves and arithmetic. Moves left become moves right, and every move but
+   the last of a block is left unwrapped, as long as they add up to less
+   than the size of the tape, which the second mapping of it covers.
+ */
+void ringMoves (long * mimem, long start, long end)
+ {
+   long i, last, run, to;
+
+   last = -1;
+   run = 0;
+   for (i = start; i < end; i++)
+    {
+      switch (mimem[i] & IMASK)
+       {
+         case '<':
+            to = (Gcells - (mimem[i] >> SHIFT) % Gcells) % Gcells;
+            if (to > MAXARG) /* Would cost more than it saves */
+             {
+               last = -1;
+               run = 0;
+               break;
+             }
+            mimem[i] = '>' | (to << SHIFT);
+
+         case '>':
+            if ((last != -1) && (run + (mimem[last] >> SHIFT) < Gcells))
+             {
+               run += mimem[last] >> SHIFT;
+               mimem[last] = RMOVE | (mimem[last] & ~IMASK);
+             }
+            else
+               run = 0;
+            last = ((mimem[i] & IMASK) == '>') ? i : -1;
+            break;
+
+         case '+': case '-': case '"': case '=':
+            break;
 
-      quanta -= cost;
+         default:
+            last = -1;
+            run = 0;
+            break;
+       }
     }
+   return;
+ }
 
+ /*
+   Is the operand of this op a distance to jump?
+ */
+int isJump (int op)
+ {
+   switch (op)
+    {
+      case '[': case ']': case '{': case '}': case '(': case '|': case ':':
+      case PLOOP:
+         return 1;
+    }
    return 0;
  }
 
-/*
-   Execute the current state.
-*/
-void execute (int quanta)
+ /*
+   Where the compiled instruction at I jumps to.
+ */
+long jumpTarget (long * code, long i)
  {
-   struct TCB * curt;
-   int c;
+   if (((code[i] & IMASK) == ']') || ((code[i] & IMASK) == '}'))
+      return i + 1 - (code[i] >> SHIFT);
+   return i + 1 + (code[i] >> SHIFT);
+ }
 
-   curt = getNextThread();
+ /*
+   Lays out N compiled instructions for the interpreter, whose operands
+   have fewer bits than the compiler's. An operand that doesn't fit makes
+   its instruction WIDE, and follows it as a long. Widening a jump moves
+   everything after it, which can push other jumps over the edge, so
+   this goes around until nothing changes. POS gets where each of the
+   instructions went, and one past the end. Returns the laid out length.
+ */
+long layout (long * code, long n, long * pos)
+ {
+   long i, t, big;
+   char * wide;
+   int changed;
 
-   while (curt != NULL)
+   big = 0;
+   for (i = 0; i < n; i++)
+      if ((code[i] >> SHIFT) > big) big = code[i] >> SHIFT;
+
+   if ((n <= 0) || (big <= MAXARG)) /* The usual: everything fits */
     {
-      if (quanta < 0)
-         c = (rand() & 127) + 1;
+      for (i = 0; i <= n; i++) pos[i] = i;
+      return n;
+    }
+
+   wide = malloc(n);
+   if (wide == NULL) return -1;
+
+   for (i = 0; i < n; i++)
+      wide[i] = !isJump(code[i] & IMASK) && ((code[i] >> SHIFT) > MAXARG);
+
+   do
+    {
+      pos[0] = 0;
+      for (i = 0; i < n; i++)
+         pos[i + 1] = pos[i] + (wide[i] ? WIDELEN : 1);
+
+      changed = 0;
+      for (i = 0; i < n; i++)
+         if (!wide[i] && isJump(code[i] & IMASK))
+          {
+            t = pos[jumpTarget(code, i)] - pos[i + 1];
+            if ((t > MAXARG) || (t < -MAXARG))
+             {
+               wide[i] = 1;
+               changed = 1;
+             }
+          }
+    }
+   while (changed);
+
+   free(wide);
+   return pos[n];
+ }
+
+ /*
+   Writes out laid out code.
+ */
+void emitCode (void * out, long * code, long n, long * pos)
+ {
+   long i, arg, op;
+   char * o;
+
+   for (i = 0; i < n; i++)
+    {
+      o = (char *) out + pos[i] * ISIZE;
+      arg = code[i] >> SHIFT;
+      if (isJump(code[i] & IMASK))
+       {
+         arg = pos[jumpTarget(code, i)] - pos[i + 1];
+         if (arg < 0) arg = -arg;
+       }
+
+      if (pos[i + 1] - pos[i] == 1)
+         op = (code[i] & IMASK) | (arg << SHIFT);
       else
-         c = quanta;
+       {
+         op = (code[i] & IMASK) | WIDE;
+         memcpy(o + ISIZE, &arg, sizeof(long));
+       }
 
-      c = doQuanta(curt, c);
+      *(int *) o = op;
+    }
+   return;
+ }
 
-      switch (c)
+ /*
+   Reserves room for compiling FIN: no more than an instruction per
+   character, and an '@' at the end, and as much again for noting where
+   the segments start. The pages only get used as needed.
+ */
+long * codeSpace (struct Input * fin, long * size)
+ {
+   struct stat st;
+   long * code;
+
+   if ((fstat(fin->fd, &st) == 0) && S_ISREG(st.st_mode))
+      *size = 2 * (st.st_size + 2) * sizeof(long);
+   else
+      *size = CMEM;
+
+   code = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   return (code == MAP_FAILED) ? NULL : code;
+ }
+
+ /*
+   The compiler, between segments.
+ */
+struct Compiler
+ {
+   struct Input * fin; /* NULL: done */
+   char * name;
+   char * tsmem;
+   long * code, * segs; /* Where each segment was laid out, going down */
+   long size, cp, nsegs;
+   long at; /* Instructions laid out so far */
+   int early; /* Processes are made as their segments are compiled */
+ };
+
+struct Compiler Gcomp;
+long Gimsize; /* Bytes of Gimem */
+
+ /*
+   Gets ready to compile FIN, the file NAME, whose processes get TSMEM for
+   system memory: room for the compiler, and for the instructions, which
+   the segments are laid out in one after the other, as they are compiled.
+   Returns 1 on success and 0 on failure.
+ */
+int compileStart (struct Input * fin, char * name, char * tsmem)
+ {
+   Gcomp.code = codeSpace(fin, &Gcomp.size);
+   if (Gcomp.code == NULL)
+    {
+      fprintf(stderr, "err: no mem for compiling\n");
+      return 0;
+    }
+   Gcomp.segs = Gcomp.code + Gcomp.size / sizeof(long); /* Grows down */
+
+   /* An op is no more than a character, and laid out, no more than wide */
+   Gimsize = Gcomp.size / sizeof(long) / 2 * WIDELEN * ISIZE;
+   if (Gdefer) Gimsize *= 2; /* And a LAZY op for each of the pieces */
+   Gimem = mmap(NULL, Gimsize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+   if (Gimem == MAP_FAILED)
+    {
+      fprintf(stderr, "err: no mem for instructions\n");
+      Gimem = NULL;
+      munmap(Gcomp.code, Gcomp.size);
+      return 0;
+    }
+
+   Gcomp.fin = fin;
+   Gcomp.name = name;
+   Gcomp.tsmem = tsmem;
+   Gcomp.cp = Gcomp.at = Gcomp.nsegs = 0;
+   Gcomp.early = 0;
+   return 1;
+ }
+
+ /*
+   Lays out the N compiled ops at CODE after all that is laid out so far.
+   Returns where they went, or NULL if there is no mem.
+ */
+void * placeCode (long * code, long n)
+ {
+   long * pos;
+   long k;
+   void * out;
+
+#ifdef DEBUG
+   for (k = 0; k < n; k++)
+      fprintf(stderr, "%c %ld\n", (int) (code[k] & IMASK), code[k] >> SHIFT);
+#endif
+
+   pos = malloc((n + 1) * sizeof(long));
+   k = (pos == NULL) ? -1 : layout(code, n, pos);
+   if ((k < 0) || ((Gcomp.at + k) * (long) ISIZE > Gimsize))
+    {
+      fprintf(stderr, "err: no mem for instructions\n");
+      free(pos);
+      return NULL;
+    }
+   out = (char *) Gimem + Gcomp.at * ISIZE;
+   emitCode(out, code, n, pos);
+   free(pos);
+
+   Gcomp.at += k;
+   return out;
+ }
+
+ /*
+   Compiles the next segment, and lays it out after the last. Returns 1 if
+   there was one, 0 at the end, and BAD if it was bad, or there was no mem.
+ */
+int compileSegment (void)
+ {
+   long * code;
+   long cp, np;
+   void * out;
+   int last;
+
+   if (Gcomp.fin->eof) return 0;
+
+   code = Gcomp.code;
+   cp = Gcomp.cp;
+   np = recCompile(code, Gcomp.fin, cp, BAD, NULL);
+   if (np == BAD)
+    {
+      fprintf(stderr, "err: \"%s\": code not syntactically correct\n",
+         Gcomp.name);
+      return BAD;
+    }
+   if (Gring) ringMoves(code, cp, np);
+
+   last = (code[np - 1] == '!');
+   if (last)
+    {
+      code[np - 1] = '@';
+      if (!Gcomp.early) /* Else it was found up front */
        {
-         case 0: // Normal time-out or yielded processor
-            schedule(curt);
-            break;
+         if ((Gnative == FORKS) || (Gnative == SHARDS)) shareIn(Gcomp.fin);
+         Gin = Gcomp.fin; /* The rest of the file is the input */
+       }
+    }
 
-         case 1: // Thread died
-            curt->par->threads--;
-            if (curt->par->threads == 0)
-               makeDead(curt->par);
-            free(curt);
-            break;
+   /* A segment's jumps stay in it: it is laid out by itself. */
+   out = placeCode(code + cp, np - cp);
+   if (out == NULL) return BAD;
 
-         case 2: // Thread blocked: put to sleep
-            appendList(&sListHead, curt);
-            break;
+   *--Gcomp.segs = ((char *) out - (char *) Gimem) / ISIZE;
+   Gcomp.nsegs++;
+   Gcomp.cp = np;
+   if (last) Gcomp.fin->eof = 1; /* Nothing more for me */
+   return 1;
+ }
+
+ /*
+   Makes the process of the Ith segment compiled, counting from 0.
+ */
+void compileBang (long i)
+ {
+   if (createProcess(NULL, NULL, Gcomp.tsmem, NULL,
+                     (char *) Gimem + Gcomp.segs[Gcomp.nsegs - 1 - i] * ISIZE,
+                     0, NULL, STACKSIZE))
+      fprintf(stderr, "err: no mem for new process\n");
+   return;
+ }
+
+ /*
+   Done compiling: the compiler's room goes.
+ */
+void compileEnd (void)
+ {
+   munmap(Gcomp.code, Gcomp.size);
+   Gcomp.fin = NULL;
+   free(Glazy);
+   Glazy = NULL;
+   return;
+ }
+
+ /*
+   With -i, the next segment is compiled, and its process made: between
+   slices, or while the native threads of the others run. Returns 0 once
+   there are no more.
+ */
+int compileNext (void)
+ {
+   if ((Gcomp.fin == NULL) || !Gcomp.early) return 0;
+   if (compileSegment() == 1)
+    {
+      compileBang(Gcomp.nsegs - 1);
+      return 1;
+    }
+   compileEnd();
+   return 0;
+ }
+
+ /*
+   With -d, the code of LAZY op I: compiled, and laid out after all the
+   rest, the first time that it is asked for. NULL if there's no mem.
+ */
+void * lazyCode (long i)
+ {
+   struct Lazy * lz;
+   struct Input in;
+   long * code;
+   long np;
+   void * out;
+
+   lz = Glazy + i;
+   out = __atomic_load_n(&lz->code, __ATOMIC_ACQUIRE);
+   if (out != NULL) return out;
+
+   pthread_mutex_lock(&GlazyLock);
+   if (lz->code == NULL)
+    {
+      in = *Gcomp.fin;
+      in.at = lz->at;
+      in.shared = NULL;
+      in.eof = 0;
+
+      code = Gcomp.code;
+      code[0] = lz->body ? ':' : '@';
+      np = recCompile(code, &in, 1, BAD, NULL);
+      if (np != BAD)
+       {
+         if (code[np - 1] == '!') code[np - 1] = '@';
+         if (Gring) ringMoves(code, 1, np);
+         out = placeCode(code + 1, np - 1);
+         __atomic_store_n(&lz->code, out, __ATOMIC_RELEASE);
+       }
+    }
+   else
+      out = lz->code;
+   pthread_mutex_unlock(&GlazyLock);
+
+   return out;
+ }
+
+ /*
+   The input to the program, from the '!' at BANG in the mapped FIN: found
+   up front, rather than by compiling up to it.
+ */
+void inputAfter (struct Input * fin, char * bang)
+ {
+   Gafter = *fin;
+   pthread_mutex_init(&Gafter.lock, NULL);
+   Gafter.at = bang + 1 - fin->buf;
+   if ((Gnative == FORKS) || (Gnative == SHARDS)) shareIn(&Gafter);
+   Gin = &Gafter;
+   return;
+ }
+
+ /*
+   With -d, the structure of all of the mapped FIN is checked, and each
+   segment's process is made to start on a LAZY op. Compiling waits for
+   the code to run. Returns 1 on success and 0 on failure.
+ */
+int compileLazy (struct Input * fin)
+ {
+   struct Lazy * all;
+   long at, np, n, nsegs, procs;
+   long op;
+   void * out;
+   char stop;
+
+   Gnlazy = 0;
+   procs = 0;
+   at = fin->at;
+   do
+    {
+      np = skimCode(fin->buf, at, fin->len, '@', 0, &procs);
+      if (np == BAD)
+       {
+         fprintf(stderr, "err: \"%s\": code not syntactically correct\n",
+            Gcomp.name);
+         return 0;
+       }
+
+      if ((Gnlazy & (Gnlazy - 1)) == 0) /* Room doubles at powers of two */
+       {
+         all = realloc(Glazy, 2 * (Gnlazy + 1) * sizeof(struct Lazy));
+         if (all == NULL)
+          {
+            fprintf(stderr, "err: no mem for compiling\n");
+            return 0;
+          }
+         Glazy = all;
        }
+      Glazy[Gnlazy].at = at;
+      Glazy[Gnlazy].body = 0;
+      Glazy[Gnlazy++].code = NULL;
 
-      curt = getNextThread();
+      stop = (np > at) ? fin->buf[np - 1] : '\0';
+      at = np;
     }
+   while (stop == '@');
 
-   return;
- }
+   all = realloc(Glazy, (Gnlazy + procs) * sizeof(struct Lazy));
+   if (all == NULL)
+    {
+      fprintf(stderr, "err: no mem for compiling\n");
+      return 0;
+    }
+   Glazy = all; /* Room for every body, so it never moves again */
 
- /*
-   An ungetc wrapper.
- */
-void unGetNext (int c, FILE * fin)
- {
-   if (c != EOF) ungetc(c, fin);
-   return;
+   if (stop == '!') inputAfter(fin, fin->buf + at - 1);
+
+   nsegs = Gnlazy; /* Native threads add bodies as soon as they start */
+   for (n = 0; n < nsegs; n++)
+    {
+      op = LAZY | (n << SHIFT);
+      pthread_mutex_lock(&GlazyLock); /* The first ones may be compiling */
+      out = placeCode(&op, 1);
+      pthread_mutex_unlock(&GlazyLock);
+      if (out == NULL) return 0;
+      if (createProcess(NULL, NULL, Gcomp.tsmem, NULL, out, 0, NULL,
+                        STACKSIZE))
+         fprintf(stderr, "err: no mem for new process\n");
+    }
+   return 1;
  }
 
  /*
-   A getc hack for this program. It filters out the crap.
+   Takes the input and creates the instruction space from it.
+   Each @ segment is compiled and laid out, and once the whole file is,
+   a process is made to run each segment. With -i, the first segment's
+   process is made as soon as it is compiled, and the rest of them come
+   after, by compileNext(). The input after a '!' is found up front, so
+   that it doesn't matter when the '!' is compiled: -i needs the file
+   to be mapped for this, and does without otherwise.
+   Returns 1 on success and 0 on failure (BACKWARDS!).
  */
-int getNext (FILE * fin)
+int Compile (struct Input * fin, char * name, char * tsmem)
  {
-   static int done = BAD;
-   int c, v;
+   char * bang;
+   long i;
+   int r;
 
-   if (done == GOOD) return EOF;
+   if (!compileStart(fin, name, tsmem)) return 0;
 
-   v = BAD;
-   while (v == BAD)
+   if (Gdefer && fin->mapped)
     {
-      c = fgetc(fin);
-      switch (c)
-       {
-         case EOF:
-            done = GOOD;
+      if (compileLazy(fin)) return 1;
+      compileEnd();
+      return 0;
+    }
 
-         case '+': case '-': case '<': case '>': case '.': case ',':
-         case '[': case ']': case '{': case '}': case '(': case '|':
-         case ')': case ':': case ';': case '$': case '`': case '\'':
-         case '^': case '_': case '%': case '&': case '#': case '~':
-         case '*': case '@': case '=': case '!':
-         case '0': case '1': case '2': case '3': case '4': case '5':
-         case '6': case '7': case '8': case '9':
-         case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
-         case 'G': case 'H': case 'I': case 'J': case 'K': case 'L':
-         case 'M': case 'N': case 'O': case 'P': case 'Q': case 'R':
-         case 'S': case 'T': case 'U': case 'V': case 'W': case 'X':
-         case 'Y': case 'Z':
-         case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-         case 'g': case 'h': case 'i': case 'j': case 'k': case 'l':
-         case 'm': case 'n': case 'o': case 'p': case 'q': case 'r':
-         case 's': case 't': case 'u': case 'v': case 'w': case 'x':
-         case 'y': case 'z':
-            v = GOOD;
-       }
+   Gcomp.early = Gearly && fin->mapped;
+   if (Gcomp.early)
+    {
+      bang = memchr(fin->buf + fin->at, '!', fin->len - fin->at);
+      if (bang != NULL) inputAfter(fin, bang);
+      if (compileNext() && (Gnative == OSTHREADS))
+         while (compileNext()) /* The native threads are running */
+            ;
+      return 1;
     }
 
-   return c;
+   while ((r = compileSegment()) == 1)
+      ;
+   if (r == 0)
+      for (i = 0; i < Gcomp.nsegs; i++)
+         compileBang(i);
+   compileEnd();
+
+   return r == 0;
  }
 
  /*
-   backFills break and continue statements.
-   Chaining the breaks recursively seemed like a good idea, but didn't
-   actually work with breaks interleaved with if statements.
+   Gets the argument of the option at NARG, either "-q5" or "-q 5".
  */
-void backFill (int * mimem, int start, int end)
+char * optArg (char *** narg)
  {
-   while (start < end)
+   char * opt;
+
+   opt = **narg;
+   if (opt[2] != '\0') return opt + 2;
+
+   if ((*narg)[1] == NULL)
     {
-      if (mimem[start] == '\'')
-         mimem[start] = '|' | (end - start - 1) << SHIFT;
-      else if (mimem[start] == '`')
-         mimem[start] = '|' | (end - start - 2) << SHIFT;
-      start++;
+      fprintf(stderr, "option \"%s\" needs an argument\n", opt);
+      exit(1);
     }
+   return *++*narg;
  }
 
  /*
-   The recursive compiler, built from the recursive matcher!
+   Reads a size, like 65536, 64k, 16M or 4G.
  */
-int recCompile (int * mimem, FILE * fin, int cp, int ll, int * pi)
+long getSize (char * arg)
  {
-   int op, np, cc, rl, bf;
+   char * end;
+   long size;
 
-   bf = 0;
-   op = cp - 1;
-   while (1)
+   size = strtol(arg, &end, 10);
+   switch (*end)
     {
-      cc = getNext(fin);
+      case 'g': case 'G': size <<= 10;
+      case 'm': case 'M': size <<= 10;
+      case 'k': case 'K': size <<= 10;
+    }
+   return size;
+ }
 
-      if (strchr("+-><^_,.~=", cc) != NULL)
-       {
-         rl = 1;
-         np = getNext(fin);
-         while (np == cc)
-          {
-            rl++;
-            np = getNext(fin);
-          }
-         unGetNext(np, fin);
-       }
-      else
-         rl = 0;
+int main (int argc, char ** argv)
+ {
+   int quantum = DEFAULTQUANTA;
+   char ** narg, * opt;
+   int i, fd, writer = 0;
 
-      mimem[cp++] = cc | (rl << SHIFT);
-      switch (cc)
+   if (argc < 2)
+    {
+      fprintf(stderr,
+         "usage: brains [-qQ i] [-u] [-t cells] [-w bits] [-r]\n"
+         "              [-n | -m workers | -p | -f | -s shards] [-a]\n"
+         "              [-b bytes] [-B fli] [-W] [-o name | -o &fd]\n"
+         "              [-i] [-d] [-A] [-lL log] files ...\n");
+      return 0;
+    }
+
+   srand(time(NULL));
+
+   narg = argv + 1;
+   while ((*narg != NULL) && ((*narg)[0] == '-'))
+    {
+      switch ((*narg)[1])
        {
-         case '~':
-            if ((rl & 1) == 0)
-               cp--;
+         case 'Q':
+            scheduler = SCHEDULE_THREAD;
+         case 'q':
+            quantum = atoi(optArg(&narg));
             break;
 
-         case '$':
-            mimem[cp - 1] = ';';
+         case 'u':
+            Gunbound = 1;
             break;
 
-         case '[':
-            np = recCompile(mimem, fin, cp, cp, NULL);
-            if (np == BAD) return BAD;
-            mimem[cp - 1] |= (np - cp) << SHIFT;
-            mimem[np - 1] |= (np - cp) << SHIFT;
-            if ((cp == 1) || ((mimem[cp - 2] & IMASK) == ']') ||
-                (mimem[cp - 2] == '"') || (mimem[cp - 2] == '@'))
-               cp--;
-            else if (((cp + 2) == np) && (mimem[cp] == ('-' | (1 << SHIFT))))
-               mimem[cp - 1] = '"';
-            else
-               cp = np;
+         case 'a':
+            Grelaxed = 1;
             break;
 
-         case '{':
-            np = recCompile(mimem, fin, cp, cp, NULL);
-            if (np == BAD) return BAD;
-            mimem[cp - 1] |= (np - cp) << SHIFT;
-            mimem[np - 1] |= (np - cp) << SHIFT;
-            if ((cp != 1) && ((mimem[cp - 2] & IMASK) == '}'))
-               cp--;
-            else
-               cp = np;
+         case 'W':
+            writer = 1;
             break;
 
-         case '(':
-            np = recCompile(mimem, fin, cp, ll, &bf);
-            if (np == BAD) return BAD;
-            cp = np;
+         case 'i':
+            Gearly = 1;
             break;
 
-         case ':':
-            np = recCompile(mimem, fin, cp, BAD, NULL);
-            if (np == BAD) return BAD;
-            cp = np;
+         case 'd':
+            Gdefer = 1;
             break;
 
-         case ']':
-            if (mimem[op] != '[') return BAD;
-            if (bf) backFill(mimem, op + 1, cp);
-            return cp;
-
-         case '}':
-            if (mimem[op] != '{') return BAD;
-            if (bf) backFill(mimem, op + 1, cp);
-            return cp;
+         case 'A':
+            Gasync = 1;
+            break;
 
-         case '|':
-            if (mimem[op] != '(') return BAD;
-            mimem[op] |= (cp - op - 1) << SHIFT;
-            op = cp - 1;
+         case 'o':
+            Groute = optArg(&narg);
+            if (Groute[0] == '&') GrouteFd = atoi(Groute + 1);
             break;
 
-         case ')':
-            if ((mimem[op] != '(') && (mimem[op] != '|')) return BAD;
-            cp--;
-            mimem[op] |= (cp - op - 1) << SHIFT;
-            if (bf) *pi |= bf;
-            return cp;
+         case 'b':
+            Goutcap = getSize(optArg(&narg));
+            if ((long) Goutcap < 1) Goutcap = 1;
+            break;
 
-         case ';':
-            if (mimem[op] != ':') return BAD;
-            mimem[op] |= (cp - op - 1) << SHIFT;
-            return cp;
+         case 'B':
+            Gflush = 0;
+            for (opt = optArg(&narg); *opt != '\0'; opt++)
+               if (*opt == 'l')
+                  Gflush |= FLINE;
+               else if (*opt == 'i')
+                  Gflush |= FREAD;
+               else if (*opt != 'f')
+                {
+                  fprintf(stderr, "output is written when full (f), at a "
+                                  "newline (l) or before input (i)\n");
+                  return 1;
+                }
+            break;
 
-         case '`':
-            if (ll == BAD) return BAD;
-            bf |= 1;
+         case 'L':
+            Greplay = 1;
+         case 'l':
+            Glog = fopen(optArg(&narg), Greplay ? "rb" : "wb");
+            if (Glog == NULL)
+             {
+               fprintf(stderr, "cannot open log \"%s\"\n", *narg);
+               return 1;
+             }
             break;
 
-         case '\'':
-            if (ll == BAD) return BAD;
-            bf |= 1;
+         case 't':
+            Gcells = getSize(optArg(&narg));
+            if ((Gcells < 2) || (Gcells & (Gcells - 1)))
+             {
+               fprintf(stderr, "tape size must be a power of two\n");
+               return 1;
+             }
             break;
 
-         case '@':
-         case '!':
-         case EOF:
-            if ((op == -1) || (mimem[op] == '@'))
+         case 'w':
+            Gwidth = atoi(optArg(&narg)) / 8;
+            if ((Gwidth != 1) && (Gwidth != 2) && (Gwidth != 4))
              {
-               if (cc == EOF) mimem[cp - 1] = '@';
-               return cp;
+               fprintf(stderr, "cells are 8, 16 or 32 bits wide\n");
+               return 1;
              }
-            else
-               return BAD;
+            break;
+
+         case 'r':
+            Gring = 1;
+            break;
+
+         case 'n':
+            Gnative = OSTHREADS;
+            break;
+
+         case 'm':
+            Gnative = WORKERS;
+            Gworkers = atoi(optArg(&narg));
+            break;
+
+         case 'p':
+            Gnative = FAMILIES;
+            break;
+
+         case 'f':
+            Gnative = FORKS;
+            break;
+
+         case 's':
+            Gnative = SHARDS;
+            Gshards = atoi(optArg(&narg));
+            break;
+
+         default:
+            fprintf(stderr, "unsupported option: \"%s\"\n", *narg);
+            return 1;
        }
+      narg++;
     }
- }
 
- /*
-   Takes the input and creates the instruction space from it.
-   Returns 1 on success and 0 on failure (BACKWARDS!).
- */
-int Compile (int * mimem, FILE * fin, FILE ** useMe, char * tsmem)
- {
-   int cp, np;
+   Gbuffered = (Gnative == OSTHREADS) || (Gnative == WORKERS) ||
+               (Gnative == FAMILIES);
+   openIn(&Gstdin, 0);
+   if ((Gnative == FORKS) || (Gnative == SHARDS)) shareIn(&Gstdin);
 
-   cp = 0;
-   while (!feof(fin))
+   if ((Glog != NULL) && Gnative)
     {
-      if (createProcess(tsmem, tsmem, NULL, mimem + cp, 0, NULL, STACKSIZE))
-         fprintf(stderr, "err: no mem for new process\n");
-      np = recCompile(mimem, fin, cp, BAD, NULL);
-      if (np == BAD) return 0;
-      cp = np;
-      if (mimem[cp - 1] == '!')
-       {
-         mimem[cp - 1] = '@';
-         *useMe = fin;
-         break;
-       }
+      fprintf(stderr, "only green threads can be logged\n");
+      return 1;
     }
 
-#ifdef DEBUG
-   for (cp = 0; cp < np; cp++)
-      fprintf(stderr, "%c %d\n", mimem[cp] & IMASK, mimem[cp] >> SHIFT);
-#endif
+   if ((Glog != NULL) && logStart(&quantum))
+    {
+      fprintf(stderr, "err: bad schedule log\n");
+      return 1;
+    }
 
-   return 1;
- }
+   if (Gflush < 0) /* As stdio would */
+      Gflush = isatty(STDOUT_FILENO) ? (FLINE | FREAD) : 0;
 
-int main (int argc, char ** argv)
- {
-   FILE * fin;
-   int quantum = DEFAULTQUANTA;
-   char ** narg;
+   Gout = malloc(Goutcap);
+   if (Gout == NULL)
+    {
+      fprintf(stderr, "err: no mem for output\n");
+      return 1;
+    }
 
-   if (argc < 2)
+   if (Gearly && Gnative && (Gnative != OSTHREADS))
     {
-      fprintf(stderr, "usage: brains [-qQ i] files ...\n");
-      return 0;
+      fprintf(stderr, "only green threads and -n start early\n");
+      return 1;
     }
 
-   useIn = stdin;
-   srand(time(NULL));
+   if (Gasync && (Gnative || (Glog != NULL)))
+    {
+      fprintf(stderr, "only unlogged green threads read input as it comes\n");
+      return 1;
+    }
 
-   narg = argv + 1;
-   if (argv[1][0] == '-')
+   if (writer && ((Gnative == FORKS) || (Gnative == SHARDS)))
     {
-      if ((argv[1][1] == 'q') || (argv[1][1] == 'Q'))
-       {
-         if (argv[1][1] == 'Q') scheduler = SCHEDULE_THREAD;
+      fprintf(stderr, "forks and shards each write their own output\n");
+      return 1;
+    }
 
-         if ((argv[1][2] >= '0') && (argv[1][2] <= '9'))
-          {
-            quantum = atoi(argv[1] + 2);
-            narg = argv + 2;
-          }
-         else
-          {
-            quantum = atoi(argv[2]);
-            narg = argv + 3;
-          }
-       }
-      else
-       {
-         fprintf(stderr, "unsupported option: \"%s\"\n", argv[1]);
-         return 1;
-       }
+   if (writer && writerStart())
+    {
+      fprintf(stderr, "err: no writer thread\n");
+      return 1;
+    }
+
+   Gdmask = Gcells - 1;
+   Gdbytes = Gcells * Gwidth;
+
+   if (Gring && (Gdbytes % sysconf(_SC_PAGESIZE)))
+    {
+      fprintf(stderr, "a ring tape must be a whole number of pages\n");
+      return 1;
+    }
+
+   if (Gring && (Gnative == SHARDS))
+    {
+      fprintf(stderr, "shards can't share a ring tape\n");
+      return 1;
+    }
+
+   if (Gwidth == 4)
+      i = 3;
+   else if (Gwidth == 2)
+      i = 2;
+   else if (Gcells == DMEM)
+      i = 0;
+   else
+      i = 1;
+   doQuanta = Gquanta[Gnative != 0][i];
+
+   if (Gnative && initNative())
+    {
+      fprintf(stderr, "err: no mem for workers\n");
+      return 1;
     }
 
    while (*narg != NULL) /* I know: I shouldn't make this assumption. */
     {
-      fin = fopen(*narg, "r");
+      fd = open(*narg, O_RDONLY);
 
-      if (fin == NULL)
+      if (fd < 0)
        {
          fprintf(stderr, "cannot open \"%s\"\n", *narg);
          narg++;
          continue;
        }
 
-      if (Compile(Gimem, fin, &useIn, Gsmem))
+      Gsmem = allocSeg(1);
+      if (Gsmem == NULL)
        {
-         memset(Gsmem, '\0', DMEM * sizeof(char));
-         execute(quantum);
+         fprintf(stderr, "err: no mem for system memory\n");
+         return 1;
        }
-      else
-         fprintf(stderr, "err: \"%s\": code not syntactically correct\n",
-               *narg);
 
-      if (useIn != stdin) useIn = stdin;
-
-      fclose(fin);
+      Gimem = NULL;
+      Grun = 1; /* Hold native threads' end until the big bang is out */
+      Gbang = 0;
+      openIn(&Gfile, fd);
+      if (!Compile(&Gfile, *narg, Gsmem))
+         ;
+      else if (Gnative == OSTHREADS)
+         executeNative();
+      else if (Gnative == WORKERS)
+         executeWorkers(quantum);
+      else if (Gnative == FAMILIES)
+         executeFamilies(quantum);
+      else if (Gnative == FORKS)
+         executeForks(quantum);
+      else if (Gnative == SHARDS)
+         executeShards(quantum);
+      else
+         execute(quantum);
 
-      if (pListHead != NULL) freePlist(pListHead);
-      pListHead = NULL;
+      flushOut();
+      flushStreams();
 
-      if (dpListHead != NULL) freePlist(dpListHead);
-      dpListHead = NULL;
+      Gin = &Gstdin;
+      if (Gcomp.fin != NULL) compileEnd(); /* -d compiled to the end */
+      closeIn(&Gfile);
+      close(fd);
 
-      if (tListHead != NULL) freeTlist(tListHead);
-      tListHead = NULL;
+      freeLists();
 
-      if (sListHead != NULL) freeTlist(sListHead);
-      sListHead = NULL;
+      freeSeg(Gsmem);
+      if (Gimem != NULL) munmap(Gimem, Gimsize);
 
       narg++;
     }
 
+   if (Glog != NULL) fclose(Glog);
+   writerStop();
+   closeStreams();
+   free(Gout);
+   closeIn(&Gstdin);
+
    return 0;
  }
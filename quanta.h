@@ -0,0 +1,807 @@
+ /*
+   quanta.h: the instruction loop of the brains interpreter.
+
+   Copyright (C) 2011 Thomas DiModica <ricinwich@yahoo.com>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+ /*
+   This file is included by brains4.c once for every kind of tape, so that
+   each gets an instruction loop of its own, and the common one doesn't pay
+   for the others. It is included again for native threads. Before including
+   it, define:
+      QNAME   The name of the function to generate.
+      QCELL   The type of a cell of the tape.
+      QMASK   The mask that wraps a data pointer around the tape.
+      QPAR    1 if other threads run at the same time, else 0.
+   QNAME, QCELL and QMASK are undefined again at the end, and QPRIVATE,
+   the name of the private loop's function, is made from QNAME.
+
+   With QPAR, cells are loaded and stored as relaxed atomics, which cost
+   nothing more on the usual machines. '+', '-', '^' and '_' are atomic
+   read-modify-writes, unless the segment is private to this thread.
+
+   A private loop (PLOOP) on a private segment, when it may run unbounded,
+   runs in a loop of its own: plain cell ops, and no ticks counted, as
+   there is nobody to stop for until it ends.
+
+   A print loop (PRINTS, [.>]) or a read loop (READS, [>,]) runs as many
+   turns in one go as its ticks would pay for, and counts them as the loop
+   would, so that a slice ends just where it would have. PRINTS and READS
+   are the first op of the loop's body, which ']' comes back to, and a
+   slice can stop at: they are a '.' and a '>' when it can't run in one
+   go, as when the output is stamped or the input logged.
+
+   CLEARS, MOVES, SHIFTR and SHIFTL are each one op, on cells of a range:
+   shared, they go a cell at a time, with atomics.
+ */
+
+#define QPRIVATE QJOIN(QNAME, Private)
+#define QCLEAR QJOIN(QNAME, Clear)
+#define QSHIFT QJOIN(QNAME, Shift)
+#define QPRINTS QJOIN(QNAME, Prints)
+#define QREADS QJOIN(QNAME, Reads)
+
+#if QPAR
+#define QLOAD(i) __atomic_load_n(cmem + (i), __ATOMIC_RELAXED)
+#define QSTORE(i, v) __atomic_store_n(cmem + (i), (v), __ATOMIC_RELAXED)
+#else
+#define QLOAD(i) (cmem[i])
+#define QSTORE(i, v) (cmem[i] = (v))
+#endif
+
+/*
+   Clears the N cells from DP on (CLEARS).
+*/
+static void QCLEAR (QCELL * cmem, long dp, long n, int atom)
+ {
+   long run;
+
+#if QPAR
+   if (atom)
+    {
+      for (; n > 0; n--, dp = (dp + 1) & QMASK)
+         QSTORE(dp, 0);
+      return;
+    }
+#else
+   (void) atom; /* Only shared segments need it */
+#endif
+   for (; n > 0; n -= run, dp = 0)
+    {
+      run = QMASK + 1 - dp;
+      if (run > n) run = n;
+      memset(cmem + dp, 0, run * sizeof(QCELL));
+    }
+   return;
+ }
+
+/*
+   Moves the N cells up to DP one cell right, the last of them added into
+   the cell after it, and the first cleared (SHIFTR); or, with LEFT, the N
+   from DP on one cell left (SHIFTL). Returns where it ends: the cleared
+   cell.
+*/
+static long QSHIFT (QCELL * cmem, long dp, long n, int left, int atom)
+ {
+   long end, from, to, i;
+   QCELL cell;
+
+   end = left ? ((dp + n - 1) & QMASK) : ((dp - n + 1) & QMASK);
+   if (!atom && (n <= QMASK) && !left && (end <= dp) && (dp < QMASK))
+    {
+      cmem[dp + 1] += cmem[dp];
+      memmove(cmem + end + 1, cmem + end, (n - 1) * sizeof(QCELL));
+      cmem[end] = 0;
+      return end;
+    }
+   if (!atom && (n <= QMASK) && left && (end >= dp) && (dp > 0))
+    {
+      cmem[dp - 1] += cmem[dp];
+      memmove(cmem + dp, cmem + dp + 1, (n - 1) * sizeof(QCELL));
+      cmem[end] = 0;
+      return end;
+    }
+
+   for (i = 0; i < n; i++) /* Around the end of the tape, or shared */
+    {
+      from = left ? ((dp + i) & QMASK) : ((dp - i) & QMASK);
+      to = left ? ((from - 1) & QMASK) : ((from + 1) & QMASK);
+#if QPAR
+      if (atom)
+       {
+         cell = __atomic_exchange_n(cmem + from, 0, __ATOMIC_RELAXED);
+         __atomic_add_fetch(cmem + to, cell, __ATOMIC_RELAXED);
+         continue;
+       }
+#endif
+      cell = cmem[from];
+      cmem[from] = 0;
+      cmem[to] += cell;
+    }
+   return end;
+ }
+
+/*
+   Runs a private loop, from just inside of it to END, just past it.
+   Returns where it ended up: END.
+*/
+static __attribute__((noinline))
+int * QPRIVATE (int * pc, int * end, QCELL * cmem, long * pdp,
+                  int * cost)
+ {
+   long arg, dp;
+   int curc;
+
+   dp = *pdp;
+   while (pc != end)
+    {
+      curc = *pc++;
+      arg = curc >> SHIFT;
+      if (curc & WIDE)
+       {
+         memcpy(&arg, pc, sizeof(long));
+         pc += sizeof(long) / sizeof(int);
+       }
+
+      switch (curc & IMASK & ~WIDE)
+       {
+         case '+':
+            cmem[dp] += arg;
+            break;
+
+         case '-':
+            cmem[dp] -= arg;
+            break;
+
+         case '>':
+            dp = (dp + arg) & QMASK;
+            break;
+
+         case '<':
+            dp = (dp - arg) & QMASK;
+            break;
+
+         case RMOVE:
+            dp += arg;
+            break;
+
+         case '"':
+            cmem[dp] = 0;
+            break;
+
+         case CLEARS:
+            QCLEAR(cmem, dp, arg, 0);
+            dp = (dp + arg) & QMASK;
+            break;
+
+         case MOVES:
+            cmem[(dp + arg) & QMASK] += cmem[dp];
+            cmem[dp] = 0;
+            break;
+
+         case SHIFTR:
+         case SHIFTL:
+            dp = QSHIFT(cmem, dp, arg, (curc & IMASK & ~WIDE) == SHIFTL, 0);
+            break;
+
+         case '[':
+         case PLOOP:
+         case '(':
+            if (cmem[dp] == 0)
+               pc += arg;
+            break;
+
+         case ']':
+            if (cmem[dp] != 0)
+               pc -= arg;
+            break;
+
+         case '{':
+            if (cmem[dp] != 0)
+               pc += arg;
+            break;
+
+         case '}':
+            if (cmem[dp] == 0)
+               pc -= arg;
+            break;
+
+         case '|':
+            pc += arg;
+            break;
+
+         case '=':
+            *cost = arg;
+            break;
+       }
+    }
+
+   *pdp = dp;
+   return pc;
+ }
+
+/*
+   Runs up to MAX turns of a print loop, from *PDP, a cell every STEP:
+   up to a zero. Returns how many it ran, and moves *PDP on as far.
+*/
+static __attribute__((noinline))
+long QPRINTS (struct TCB * me, QCELL * cmem, long * pdp, long step, long max,
+              int atom)
+ {
+   char b [256];
+   char * z;
+   long dp, n, len, run;
+
+   dp = *pdp;
+   n = 0;
+   len = 0;
+   if ((sizeof(QCELL) == 1) && (step == 1) && !atom)
+      while (n < max) /* Straight from the tape, to its end at most */
+       {
+         run = QMASK + 1 - dp;
+         if (run > max - n) run = max - n;
+         z = memchr(cmem + dp, 0, run);
+         if (z != NULL) run = z - (char *) (cmem + dp);
+         if (run == 0) break;
+#if QPAR
+         if (Groute != NULL)
+            streamString(me->par->out, (char *) (cmem + dp), run);
+         else
+            fwrite(cmem + dp, 1, run, stdout);
+#else
+         if (Groute != NULL)
+            streamString(me->par->out, (char *) (cmem + dp), run);
+         else
+            putString((char *) (cmem + dp), run);
+#endif
+         n += run;
+         dp = (dp + run) & QMASK;
+         if (z != NULL) break;
+       }
+   else
+      for (; (n < max) && (QLOAD(dp) != 0); n++)
+       {
+         b[len++] = QLOAD(dp);
+         dp = (dp + step) & QMASK;
+         if ((len == sizeof(b)) || (n + 1 == max) || (QLOAD(dp) == 0))
+          {
+#if QPAR
+            if (Groute != NULL)
+               streamString(me->par->out, b, len);
+            else
+               fwrite(b, 1, len, stdout);
+#else
+            if (Groute != NULL)
+               streamString(me->par->out, b, len);
+            else
+               putString(b, len);
+#endif
+            len = 0;
+          }
+       }
+
+   *pdp = dp;
+   return n;
+ }
+
+#if !QPAR
+/*
+   Runs up to MAX turns of a read loop, from *PDP, a cell every STEP: as
+   far as a zero byte, or as the input that there is now. Returns how many
+   it ran, and moves *PDP on as far.
+*/
+static __attribute__((noinline))
+long QREADS (QCELL * cmem, long * pdp, long step, long max)
+ {
+   char * p;
+   long dp, n, k, i;
+
+   dp = *pdp;
+   n = 0;
+   while (n < max)
+    {
+      if (Gasync && !inReady(Gin, 0)) break;
+      k = peekIn(Gin, &p);
+      if (k == 0) break;
+      if (k > max - n) k = max - n;
+      for (i = 0; i < k; )
+       {
+         dp = (dp + step) & QMASK;
+         cmem[dp] = (unsigned char) p[i++];
+         if (cmem[dp] == 0) break;
+       }
+      takeIn(Gin, i);
+      n += i;
+      if (cmem[dp] == 0) break;
+    }
+
+   *pdp = dp;
+   return n;
+ }
+#endif
+
+/*
+   Execute a quanta of instructions...
+   Return:
+      0 Normal
+      1 Die
+      2 Sleep
+      3 Forked away: this is the child, and I'm the parent's thread
+      4 Wait for input (green)
+*/
+int QNAME (struct TCB * me, int quanta)
+ {
+   int cost = 1, curc, count, forever;
+   long arg;
+   int * pc, * ip;
+   QCELL * cmem;
+   long dp;
+   long pdp; /* For a private loop, so that dp and cost stay in registers */
+   int pcost;
+   long turns, done; /* For a print or read loop */
+#if QPAR
+   QCELL cell;
+   int atom; /* Other threads can get at this segment */
+#endif
+
+   if (quanta == 0) forever = 1;
+   else forever = 0;
+
+   pc = me->pc;
+   cmem = (QCELL *) me->cmem;
+   dp = me->dp;
+#if QPAR
+   atom = sharedSeg(me);
+#endif
+
+   while (forever || (quanta > 0))
+    {
+
+      ip = pc;
+      curc = *pc++;
+      arg = curc >> SHIFT;
+
+#ifdef DEBUG
+      fprintf(stderr, "%p : %c  %ld\n", me, curc & IMASK, arg);
+#endif
+
+dispatch:
+      switch (curc & IMASK)
+       {
+         case '+':
+#if QPAR
+            if (atom)
+             {
+               __atomic_add_fetch(cmem + dp, arg, __ATOMIC_RELAXED);
+               break;
+             }
+#endif
+            cmem[dp] += arg;
+            break;
+
+         case '-':
+#if QPAR
+            if (atom)
+             {
+               __atomic_sub_fetch(cmem + dp, arg, __ATOMIC_RELAXED);
+               break;
+             }
+#endif
+            cmem[dp] -= arg;
+            break;
+
+         case '>':
+            dp = (dp + arg) & QMASK;
+            break;
+
+         case '<':
+            dp = (dp - arg) & QMASK;
+            break;
+
+         case RMOVE:
+            dp += arg;
+            break;
+
+         case '.':
+#if QPAR
+            if (Groute != NULL)
+             {
+               streamPut(me->par->out, QLOAD(dp), arg);
+               break;
+             }
+            if (Gbuffered)
+             {
+               outPut(me, QLOAD(dp), arg);
+               break;
+             }
+            flockfile(stdout);
+            while (arg--)
+               putc_unlocked(QLOAD(dp), stdout);
+            funlockfile(stdout);
+#else
+            if (Groute != NULL)
+               streamPut(me->par->out, cmem[dp], arg);
+            else
+               putOut(cmem[dp], arg);
+#endif
+            break;
+
+         case ',':
+#if QPAR
+            if (Gbuffered && (Gflush & FREAD)) outFlush(me->out);
+            curc = readIn(arg);
+            if (curc != EOF) QSTORE(dp, curc);
+#else
+            if (Gflush & FREAD) flushOut();
+            if (!Gasync)
+               curc = readIn(arg);
+            else if ((me->want += readReady(arg - me->want, &curc)) < arg)
+             {
+               if (curc != EOF) cmem[dp] = curc;
+               pc = ip; /* Wait for the rest of the run. */
+               me->pc = pc;
+               me->dp = dp;
+               return 4;
+             }
+            else
+               me->want = 0;
+            if (curc != EOF) cmem[dp] = curc;
+#endif
+            break;
+
+         case '[':
+         case '(':
+            if (QLOAD(dp) == 0)
+               pc += arg;
+            break;
+
+         case PLOOP:
+            if (QLOAD(dp) == 0)
+             {
+               pc += arg;
+               break;
+             }
+#if QPAR
+            if (atom) break;
+#endif
+            if (!forever && !Gunbound) break; /* Just a '[' */
+
+            pdp = dp;
+            pcost = cost;
+            pc = QPRIVATE(pc, pc + arg, cmem, &pdp, &pcost);
+            dp = pdp;
+            cost = pcost;
+            break;
+
+         case PRINTS:
+         case READS:
+            /* The first op of a print or read loop's body */
+#if QPAR
+            if (((curc & IMASK) == READS) || ((Groute == NULL) && Gbuffered))
+               goto plain;
+#else
+            if (((curc & IMASK) == READS) &&
+                ((Glog != NULL) || Greplay || (Gin->buf == NULL)))
+               goto plain;
+#endif
+
+            /* A turn is three ops: how many turns would the ticks pay for? */
+            if (forever || (cost == 0))
+               turns = LONG_MAX;
+            else
+               turns = ((quanta + cost - 1) / cost) / 3;
+            if ((turns == 0) || (QLOAD(dp) == 0)) goto plain;
+
+            pdp = dp;
+#if QPAR
+            flockfile(stdout);
+            done = QPRINTS(me, cmem, &pdp, pc[0] >> SHIFT, turns, atom);
+            funlockfile(stdout);
+#else
+            if ((curc & IMASK) == PRINTS)
+               done = QPRINTS(me, cmem, &pdp, pc[0] >> SHIFT, turns, 0);
+            else
+             {
+               if (Gflush & FREAD) flushOut();
+               done = QREADS(cmem, &pdp, arg, turns);
+             }
+#endif
+            dp = pdp;
+
+            if ((QLOAD(dp) == 0) || (done == turns))
+             {
+               if (QLOAD(dp) == 0)
+                  pc = ip + 3; /* Out of the loop */
+               else
+                  pc = ip; /* Out of ticks: the rest, next time */
+               quanta -= (3 * done - 1) * cost; /* And this op's below */
+               break;
+             }
+            quanta -= 3 * done * cost; /* No input yet: the next turn's ',' */
+                                       /* waits for it, as usual */
+plain:
+            curc = ((curc & IMASK) == PRINTS) ? '.' : '>';
+            goto dispatch;
+
+         case '}':
+            if (QLOAD(dp) == 0)
+               pc -= arg;
+            break;
+
+         case ']':
+            if (QLOAD(dp) != 0)
+               pc -= arg;
+            break;
+
+         case '{':
+            if (QLOAD(dp) != 0)
+               pc += arg;
+            break;
+
+         case ':':
+            count = procNum(*pc);
+            if (count != NOPROC)
+               me->procs[count] = pc + 1;
+
+         case '|':
+            pc += arg;
+            break;
+
+         case '&':
+            QSTORE(dp, 0);
+            QSTORE((dp + 1) & QMASK, 1);
+            if (createThread(me->par, me->procs, pc, (dp + 1) & QMASK,
+                             me->cmem, me->stack, me->sp))
+               QSTORE((dp + 1) & QMASK, 0);
+#if QPAR
+            atom = sharedSeg(me);
+#endif
+            break;
+
+         case '%':
+            QSTORE(dp, 0);
+            QSTORE((dp + 1) & QMASK, 1);
+            if (createProcess(me->cmem, me->par, me->par->dmem, me->procs,
+                              pc, (dp + 1) & QMASK, me->stack, me->sp))
+               QSTORE((dp + 1) & QMASK, 0);
+#if QPAR
+            else if (Gchild != NULL)
+             {
+               me->pc = pc;
+               me->dp = dp;
+               return 3;
+             }
+            atom = sharedSeg(me);
+#endif
+            break;
+
+         case '^':
+#if QPAR
+            if (!atom) /* Only my own could be waiting: with -p */
+             {
+               cmem[dp] += arg;
+               while (arg-- && (sListHead != NULL))
+                  checkSemaphores(me->cmem, dp);
+             }
+            else
+             {
+               /* Release, and ordered before looking for sleepers */
+               __atomic_add_fetch(cmem + dp, arg, __ATOMIC_SEQ_CST);
+               if (Gnative == FORKS)
+                  wakeForks(0);
+               else if (Gnative == SHARDS)
+                  shardUp(dp);
+               else
+                  wakeCell(me->cmem, dp);
+             }
+#else
+            cmem[dp] += arg;
+            while (arg--)
+               if (sListHead != NULL)
+                  checkSemaphores(me->cmem, dp);
+#endif
+            break;
+
+         case '_':
+#if QPAR
+            if (!atom && (cmem[dp] >= arg))
+             {
+               cmem[dp] -= arg;
+               break;
+             }
+            if (atom && (Gnative == SHARDS))
+             {
+               me->pc = pc; /* The interpreter does it: don't re-try it */
+               me->dp = dp;
+               shardDown(me, dp, arg);
+               return 2;
+             }
+            cell = __atomic_load_n(cmem + dp, __ATOMIC_RELAXED);
+            do
+               if (cell < arg)
+                {
+                  pc = ip; /* Re-try the down, after a sleep. */
+                  me->pc = pc;
+                  me->dp = dp;
+                  me->want = arg;
+                  return 2;
+                }
+            while (!__atomic_compare_exchange_n(cmem + dp, &cell, cell - arg,
+                       1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+#else
+            if (cmem[dp] < arg)
+             {
+               pc = ip; /* Re-try the down. */
+               me->pc = pc;
+               me->dp = dp;
+               return 2;
+             }
+            else
+               cmem[dp] -= arg;
+#endif
+            break;
+
+         case '*':
+            me->pc = pc;
+            me->dp = dp;
+            return 0;
+
+         case '@':
+            me->pc = pc;
+            me->dp = dp;
+            return 1;
+
+         case ')':
+            break;
+
+         case '=':
+            cost = arg;
+            break;
+
+         case '"':
+            QSTORE(dp, 0);
+            break;
+
+         case CLEARS:
+#if QPAR
+            QCLEAR(cmem, dp, arg, atom);
+#else
+            QCLEAR(cmem, dp, arg, 0);
+#endif
+            dp = (dp + arg) & QMASK;
+            break;
+
+         case MOVES:
+#if QPAR
+            if (atom)
+             {
+               cell = __atomic_exchange_n(cmem + dp, 0, __ATOMIC_RELAXED);
+               __atomic_add_fetch(cmem + ((dp + arg) & QMASK), cell,
+                  __ATOMIC_RELAXED);
+               break;
+             }
+#endif
+            cmem[(dp + arg) & QMASK] += cmem[dp];
+            cmem[dp] = 0;
+            break;
+
+         case SHIFTR:
+         case SHIFTL:
+#if QPAR
+            dp = QSHIFT(cmem, dp, arg, (curc & IMASK) == SHIFTL, atom);
+#else
+            dp = QSHIFT(cmem, dp, arg, (curc & IMASK) == SHIFTL, 0);
+#endif
+            break;
+
+         case '~':
+            if (me->cmem == me->par->pmem)
+               me->cmem = me->par->dmem;
+            else if (me->par->pmem != NULL) /* If I don't want smem */
+               me->cmem = me->par->pmem;
+            cmem = (QCELL *) me->cmem;
+#if QPAR
+            atom = sharedSeg(me);
+#endif
+            break;
+
+         case ';':
+            if (me->sp == STACKSIZE)
+             {
+               me->pc = pc;
+               me->dp = dp;
+               return 1;
+             }
+            else
+               pc = me->stack[me->sp++];
+            break;
+
+         case LAZY: /* Free: it is as if the code were already here */
+            pc = lazyCode(arg);
+            if (pc == NULL)
+             {
+               me->pc = ip;
+               me->dp = dp;
+               return 1;
+             }
+            ip = pc;
+            curc = *pc++;
+            arg = curc >> SHIFT;
+            goto dispatch;
+
+         case '#':
+            cost = 0;
+#if QPAR
+            if (Gbuffered) outFlush(me->out);
+            flockfile(stdout);
+#else
+            flushOut();
+#endif
+            printf("\npc: %ld\ndp: %ld\nticks: %d\ndata:",
+               (long) (pc - (int *) Gimem), dp, quanta);
+            for (curc = 0; curc < 16; curc++)
+               printf(" %0*x", (int) (2 * sizeof(QCELL)),
+                  (unsigned QCELL) QLOAD((dp + curc) & QMASK));
+            putchar('\n');
+#if QPAR
+            funlockfile(stdout);
+#endif
+            break;
+
+         default:
+            if (curc & WIDE)
+             {
+               memcpy(&arg, pc, sizeof(long));
+               pc += sizeof(long) / sizeof(int);
+               curc &= IMASK & ~WIDE;
+               goto dispatch;
+             }
+
+            curc = procNum(curc);
+            if ((curc != NOPROC) && (me->procs[curc] != NULL))
+             {
+               if ((*pc == ';') || (*pc == '$'))
+                  pc = me->procs[curc];
+               else if (me->sp == 0)
+                  fprintf(stderr, "err: no mem for call\n");
+               else
+                {
+                  me->stack[--me->sp] = pc;
+                  pc = me->procs[curc];
+                }
+             }
+            else
+               cost = 0;
+            break;
+       }
+
+      quanta -= cost;
+    }
+
+   me->pc = pc;
+   me->dp = dp;
+   return 0;
+ }
+
+#undef QPRIVATE
+#undef QCLEAR
+#undef QSHIFT
+#undef QPRINTS
+#undef QREADS
+#undef QNAME
+#undef QCELL
+#undef QMASK
+#undef QLOAD
+#undef QSTORE
@@ -0,0 +1 @@
+--&>>>+++.,._<<<<+..<<<<<----~~~@^++++.++(_.&|^*+).>>>>>>
\ No newline at end of file
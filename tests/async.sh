@@ -0,0 +1,28 @@
+#!/bin/sh
+# Two processes (async.b) each read a byte while the other runs. Without
+# -A, a green run must print the same whether its input is a file or a
+# pipe that only fills later: a ',' waits for its input, so the schedule
+# never depends on when it comes.
+#
+# usage: async.sh brains
+#    as in: async.sh ./brains
+
+dir=`dirname "$0"`
+tmp=${TMPDIR:-/tmp}/async.$$
+fail=0
+
+printf AB > "$tmp"
+for quanta in "" "-q 1" "-Q 3"
+ do
+   want=`"$1" $quanta "$dir/async.b" < "$tmp" | od -c`
+   got=`(sleep 0.3; printf AB) | timeout 5 "$1" $quanta "$dir/async.b" | od -c`
+   if [ "$got" != "$want" ]
+    then
+      echo "async $quanta: failed"
+      fail=1
+    fi
+ done
+rm -f "$tmp"
+
+[ $fail = 0 ] && echo "async: ok"
+exit $fail
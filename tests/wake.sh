@@ -0,0 +1,23 @@
+#!/bin/sh
+# A thread sleeps on a cell of the system memory, and is woken by another
+# that then busy-waits for it (wake.b): the woken one must get to run, or
+# the waiter never stops. It prints "I" in every mode.
+#
+# usage: wake.sh brains
+#    as in: wake.sh ./brains
+
+dir=`dirname "$0"`
+fail=0
+
+for mode in "" "-n" "-m 2" "-p" "-f" "-s 2"
+ do
+   out=`timeout 5 "$1" $mode "$dir/wake.b" < /dev/null`
+   if [ "$out" != "I" ]
+    then
+      echo "wake $mode: failed"
+      fail=1
+    fi
+ done
+
+[ $fail = 0 ] && echo "wake: ok"
+exit $fail